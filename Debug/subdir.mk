@@ -12,6 +12,7 @@ CPP_SRCS += \
 ../ipoint.cpp \
 ../opensurf.cpp \
 ../surf.cpp \
+../threadpool.cpp \
 ../topsurf.cpp 
 
 OBJS += \
@@ -23,6 +24,7 @@ OBJS += \
 ./ipoint.o \
 ./opensurf.o \
 ./surf.o \
+./threadpool.o \
 ./topsurf.o 
 
 CPP_DEPS += \
@@ -34,6 +36,7 @@ CPP_DEPS += \
 ./ipoint.d \
 ./opensurf.d \
 ./surf.d \
+./threadpool.d \
 ./topsurf.d 
 
 
@@ -30,16 +30,17 @@ void Descriptor2Array(const TOPSURF_DESCRIPTOR &td, unsigned char *&data, int &l
 void Array2Descriptor(const unsigned char *data, TOPSURF_DESCRIPTOR &td);
 
 // the topsurf object
+// Note: it is shared by all threads that extract descriptors
 TopSurf *topsurf = NULL;
 
-bool TopSurf_Initialize(int imagedim, int top)
+bool TopSurf_Initialize(int imagedim, int top, int threads, TOPSURF_PRESET preset)
 {
 	if (topsurf)
 	{
 		SAFE_FLUSHPRINT(stderr, "TOP-SURF has already been initialized\n");
 		return false;
 	}
-	topsurf = NEW TopSurf(imagedim, top);
+	topsurf = NEW TopSurf(imagedim, top, threads, preset);
 	return true;
 }
 
@@ -48,6 +49,39 @@ void TopSurf_Terminate()
 	SAFE_DELETE(topsurf);
 }
 
+bool TopSurf_SetPointBudget(int maxpoints, bool spread)
+{
+	if (!topsurf)
+	{
+		SAFE_FLUSHPRINT(stderr, "TOP-SURF has not yet been initialized\n");
+		return false;
+	}
+	topsurf->SetPointBudget(maxpoints, spread);
+	return true;
+}
+
+bool TopSurf_SetTimeBudget(int milliseconds, int enoughpoints)
+{
+	if (!topsurf)
+	{
+		SAFE_FLUSHPRINT(stderr, "TOP-SURF has not yet been initialized\n");
+		return false;
+	}
+	topsurf->SetTimeBudget(milliseconds, enoughpoints);
+	return true;
+}
+
+bool TopSurf_SetHaarMaps(bool haarmaps)
+{
+	if (!topsurf)
+	{
+		SAFE_FLUSHPRINT(stderr, "TOP-SURF has not yet been initialized\n");
+		return false;
+	}
+	topsurf->SetHaarMaps(haarmaps);
+	return true;
+}
+
 bool TopSurf_LoadDictionary(const char *dictionarydir)
 {
 	if (!topsurf)
@@ -85,22 +119,55 @@ bool TopSurf_ExtractDescriptor(const char *fname, TOPSURF_DESCRIPTOR &td)
 		SAFE_FLUSHPRINT(stderr, "TOP-SURF has not yet been initialized\n");
 		return false;
 	}
-	// load image from disk
-	IplImage *image = cvLoadImage(fname, CV_LOAD_IMAGE_COLOR);
-	if (image == NULL)
+	// extract the descriptor while loading the image from disk
+	return topsurf->ExtractDescriptor(fname, td);
+}
+
+bool TopSurf_ExtractDescriptors(const char **fnames, int count, TOPSURF_DESCRIPTOR *td)
+{
+	if (!topsurf)
 	{
-		SAFE_FLUSHPRINT(stderr, "could not load image %s\n", fname);
+		SAFE_FLUSHPRINT(stderr, "TOP-SURF has not yet been initialized\n");
 		return false;
 	}
-	// extract the descriptor
-	if (!topsurf->ExtractDescriptor(*image, td))
+	for (int i = 0; i < count; i++)
 	{
-		cvReleaseImage(&image);
-		return false;
+		td[i].count = 0;
+		td[i].visualword = NULL;
 	}
-	// release resources
-	cvReleaseImage(&image);
-	return true;
+	// load the images from disk a batch at a time, so only a few of them are
+	// kept in memory at once
+	const int batchsize = OpenSurf::GetBatchSize();
+	vector<IplImage *> images;
+	bool success = true;
+	for (int first = 0; first < count && success; first += batchsize)
+	{
+		const int last = min(first + batchsize, count);
+		images.clear();
+		for (int i = first; i < last; i++)
+		{
+			IplImage *image = topsurf->LoadImage(fnames[i]);
+			if (image == NULL)
+			{
+				SAFE_FLUSHPRINT(stderr, "could not load image %s\n", fnames[i]);
+				success = false;
+				break;
+			}
+			images.push_back(image);
+		}
+		// extract the descriptors
+		if (success)
+			success = topsurf->ExtractDescriptors(&images[0], last - first, td + first);
+		// release resources
+		for (size_t i = 0; i < images.size(); i++)
+			cvReleaseImage(&images[i]);
+	}
+	if (!success)
+	{
+		for (int i = 0; i < count; i++)
+			TopSurf::ReleaseDescriptor(td[i]);
+	}
+	return success;
 }
 
 bool TopSurf_ExtractDescriptor(const char *fname, unsigned char *&data, int &length)
@@ -133,36 +200,76 @@ bool TopSurf_ExtractDescriptor(const unsigned char *pixels, int dimx, int dimy,
 		SAFE_FLUSHPRINT(stderr, "invalid image data provided\n");
 		return false;
 	}
-	// convert pixels to opencv image type
-	IplImage *image = cvCreateImage(cvSize(dimx, dimy), IPL_DEPTH_8U, 3);
-	if (image == NULL)
+	// extract the descriptor from the pixels in place
+	// Note: the pixels are only read
+	TOPSURF_IMAGEVIEW view((unsigned char *)pixels, dimx, dimy, dimx * 3, TOPSURF_PIXEL_RGB);
+	return topsurf->ExtractDescriptor(view, td);
+}
+
+bool TopSurf_ExtractDescriptor(const unsigned char *pixels, int dimx, int dimy, unsigned char *&data, int &length)
+{
+	if (&data == NULL)
 	{
-		SAFE_FLUSHPRINT(stderr, "could not convert image data\n");
+		SAFE_FLUSHPRINT(stderr, "invalid descriptor data provided\n");
 		return false;
 	}
-	const unsigned char *temp = pixels;
-	for (int y = 0; y < dimy; y++)
+	// extract the descriptor
+	TOPSURF_DESCRIPTOR td;
+	if (!TopSurf_ExtractDescriptor(pixels, dimx, dimy, td))
+		return false;
+	// convert the descriptor to an array
+	Descriptor2Array(td, data, length);
+	// release resources
+	TopSurf::ReleaseDescriptor(td);
+	return true;
+}
+
+bool TopSurf_ExtractDescriptor(const TOPSURF_IMAGEVIEW &view, TOPSURF_DESCRIPTOR &td)
+{
+	if (!topsurf)
 	{
-		for (int x = 0; x < dimx; x++, temp+=3)
-		{
-			// the pixels are stored as RGB, whereas opencv stores them as BGR
-			((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 0] = temp[2];
-			((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 1] = temp[1];
-			((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 2] = temp[0];
-		}
+		SAFE_FLUSHPRINT(stderr, "TOP-SURF has not yet been initialized\n");
+		return false;
 	}
-	// use the newly created image to extract the descriptor
-	if (!topsurf->ExtractDescriptor(*image, td))
+	// extract the descriptor from the pixels in place
+	return topsurf->ExtractDescriptor(view, td);
+}
+
+bool TopSurf_ExtractDescriptor(const TOPSURF_IMAGEVIEW &view, unsigned char *&data, int &length)
+{
+	if (&data == NULL)
 	{
-		cvReleaseImage(&image);
+		SAFE_FLUSHPRINT(stderr, "invalid descriptor data provided\n");
 		return false;
 	}
+	// extract the descriptor
+	TOPSURF_DESCRIPTOR td;
+	if (!TopSurf_ExtractDescriptor(view, td))
+		return false;
+	// convert the descriptor to an array
+	Descriptor2Array(td, data, length);
 	// release resources
-	cvReleaseImage(&image);
+	TopSurf::ReleaseDescriptor(td);
 	return true;
 }
 
-bool TopSurf_ExtractDescriptor(const unsigned char *pixels, int dimx, int dimy, unsigned char *&data, int &length)
+bool TopSurf_ExtractDescriptorFromMemory(const unsigned char *encoded, size_t size, TOPSURF_DESCRIPTOR &td)
+{
+	if (!topsurf)
+	{
+		SAFE_FLUSHPRINT(stderr, "TOP-SURF has not yet been initialized\n");
+		return false;
+	}
+	if (encoded == NULL || size == 0)
+	{
+		SAFE_FLUSHPRINT(stderr, "invalid image data provided\n");
+		return false;
+	}
+	// extract the descriptor while decoding the image
+	return topsurf->ExtractDescriptor(encoded, size, td);
+}
+
+bool TopSurf_ExtractDescriptorFromMemory(const unsigned char *encoded, size_t size, unsigned char *&data, int &length)
 {
 	if (&data == NULL)
 	{
@@ -171,7 +278,7 @@ bool TopSurf_ExtractDescriptor(const unsigned char *pixels, int dimx, int dimy,
 	}
 	// extract the descriptor
 	TOPSURF_DESCRIPTOR td;
-	if (!TopSurf_ExtractDescriptor(pixels, dimx, dimy, td))
+	if (!TopSurf_ExtractDescriptorFromMemory(encoded, size, td))
 		return false;
 	// convert the descriptor to an array
 	Descriptor2Array(td, data, length);
@@ -291,40 +398,14 @@ bool TopSurf_VisualizeDescriptor(unsigned char *pixels, int dimx, int dimy, TOPS
 		SAFE_FLUSHPRINT(stderr, "invalid image data provided\n");
 		return false;
 	}
-	// convert pixels to opencv image type
-	IplImage *image = cvCreateImage(cvSize(dimx, dimy), IPL_DEPTH_8U, 3);
-	if (image == NULL)
-	{
-		SAFE_FLUSHPRINT(stderr, "could not convert image data\n");
-		return false;
-	}
-	unsigned char *temp = pixels;
-	for (int y = 0; y < dimy; y++)
-	{
-		for (int x = 0; x < dimx; x++, temp+=3)
-		{
-			// the pixels are stored as RGB, whereas opencv stores them as BGR
-			((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 0] = temp[2];
-			((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 1] = temp[1];
-			((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 2] = temp[0];
-		}
-	}
-	// visualize the descriptor
-	TopSurf::VisualizeDescriptor(*image, td);
-	// convert our image representation back to the RGB array
-	temp = pixels;
-	for (int y = 0; y < dimy; y++)
-	{
-		for (int x = 0; x < dimx; x++, temp+=3)
-		{
-			temp[2] = ((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 0];
-			temp[1] = ((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 1];
-			temp[0] = ((uchar *)(image->imageData + y*image->widthStep))[x*image->nChannels + 2];
-		}
-	}
-	// release resources
-	cvReleaseImage(&image);
-	return true;
+	// visualize the descriptor on the pixels in place
+	TOPSURF_IMAGEVIEW view(pixels, dimx, dimy, dimx * 3, TOPSURF_PIXEL_RGB);
+	return TopSurf::VisualizeDescriptor(view, td);
+}
+
+bool TopSurf_VisualizeDescriptor(const TOPSURF_IMAGEVIEW &view, TOPSURF_DESCRIPTOR &td)
+{
+	return TopSurf::VisualizeDescriptor(view, td);
 }
 
 bool TopSurf_VisualizeDescriptor(unsigned char *pixels, int dimx, int dimy, const unsigned char *data)
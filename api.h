@@ -43,13 +43,68 @@
 // top      = top number of highest-scoring visual words to retain
 //            (suggested = 100. passing a high value, e.g. INT_MAX, will result in
 //            all visual words being returned)
+// threads  = number of threads that detect and describe the interest points of a
+//            single image
+//            (suggested = 1 when extracting many images at once, or the number of
+//            cores when the time to extract a single image matters most)
+// preset   = how the interest points are detected and described, see descriptor.h
+//            (suggested = TOPSURF_PRESET_FULL, or TOPSURF_PRESET_UPRIGHT for images
+//            that never appear rotated, e.g. scanned documents, which skips assigning
+//            an orientation to every interest point)
 // returns true for success and false for failure. in case of failure a message is
 // printed to stderr.
-bool DLLAPI TopSurf_Initialize(int imagedim, int top);
+// Note: every thread that extracts descriptors at the same time uses its own set of
+//       threads to detect and describe the interest points.
+// Note: the preset is saved with the dictionary. loading a dictionary replaces the
+//       preset with the one the dictionary was created with.
+bool DLLAPI TopSurf_Initialize(int imagedim, int top, int threads = 1, TOPSURF_PRESET preset = TOPSURF_PRESET_FULL);
 
 // terminate the wrapper
 void DLLAPI TopSurf_Terminate();
 
+// limit the number of interest points that are extracted from an image
+// maxpoints = maximum number of interest points to describe and assign to visual
+//             words, where the points with the strongest responses are kept
+//             (suggested = 0, which means no limit. a limit bounds the time needed
+//             to extract a descriptor for highly textured images)
+// spread    = select the points by adaptive non-maximal suppression instead, which
+//             keeps strong points that are spread across the image
+// returns true for success and false for failure. in case of failure a message is
+// printed to stderr.
+// Note: TopSurf_Initialized must have been called in order to use this function,
+//       and no descriptors may be extracted in the meantime.
+bool DLLAPI TopSurf_SetPointBudget(int maxpoints, bool spread);
+
+// limit the time spent on extracting the interest points of an image
+// milliseconds = time allowed for detecting and describing the interest points
+//                (suggested = 0, which means no limit. with a limit the image is
+//                searched from coarse to fine scales, and the descriptor is built
+//                from the points found when time is up)
+// enoughpoints = stop searching finer scales once this many interest points were
+//                found, or 0 to only stop when time is up
+// returns true for success and false for failure. in case of failure a message is
+// printed to stderr.
+// Note: loading the image and looking up the visual words are not part of the
+//       limit. the limit is not exact either, since the scale that is being
+//       searched when time is up is still finished.
+// Note: the scales are always searched until one with any interest points was
+//       found, and the points found up to then are always described, so even a
+//       tight limit only gives an empty descriptor for an image without points.
+// Note: TopSurf_Initialized must have been called in order to use this function,
+//       and no descriptors may be extracted in the meantime.
+bool DLLAPI TopSurf_SetTimeBudget(int milliseconds, int enoughpoints);
+
+// share the haar wavelet responses between the interest points of an image
+// haarmaps = calculate the responses at each wavelet size once for the entire image
+//            instead of for every interest point on its own (suggested = false. the
+//            descriptors are the same either way, but it pays off for images with
+//            many overlapping interest points)
+// returns true for success and false for failure. in case of failure a message is
+// printed to stderr.
+// Note: TopSurf_Initialized must have been called in order to use this function,
+//       and no descriptors may be extracted in the meantime.
+bool DLLAPI TopSurf_SetHaarMaps(bool haarmaps);
+
 // load a dictionary
 // dictionarydir = directory in which the dictionary is located
 //                 (the one containing the dictionary.xml file and its supporting data
@@ -113,11 +168,52 @@ bool DLLAPI TopSurf_CreateDictionary(const char *imagedir, int clusters, int knn
 //          count        = number of visual words in the descriptor
 //          length       = vector length of the descriptor (only written if count > 0)
 //          visualwords  = the visual words (only written if count > 0)
+// Note: descriptors can be extracted from multiple threads at the same time, which
+//       all share the same dictionary. make sure that the wrapper is not initialized
+//       or terminated and that no dictionary is loaded or created in the meantime.
 bool DLLAPI TopSurf_ExtractDescriptor(const char *fname, TOPSURF_DESCRIPTOR &td);
 bool DLLAPI TopSurf_ExtractDescriptor(const char *fname, unsigned char *&data, int &length);
 bool DLLAPI TopSurf_ExtractDescriptor(const unsigned char *pixels, int dimx, int dimy, TOPSURF_DESCRIPTOR &td);
 bool DLLAPI TopSurf_ExtractDescriptor(const unsigned char *pixels, int dimx, int dimy, unsigned char *&data, int &length);
 
+// extract the descriptor of an image in memory in any of the supported pixel formats
+// view = the pixels of the image, see TOPSURF_IMAGEVIEW. the rows may be padded, e.g.
+//        as in video frames
+// td, data, length = see TopSurf_ExtractDescriptor
+// returns true for success and false for failure. in case of failure a message is
+// printed to stderr.
+// Note: the pixels are read in place, without being copied or converted first.
+// Note: TopSurf_Initialized must have been called in order to use this function.
+bool DLLAPI TopSurf_ExtractDescriptor(const TOPSURF_IMAGEVIEW &view, TOPSURF_DESCRIPTOR &td);
+bool DLLAPI TopSurf_ExtractDescriptor(const TOPSURF_IMAGEVIEW &view, unsigned char *&data, int &length);
+
+// extract the descriptor of an encoded image in memory
+// encoded = the bytes of a jpeg or png image, e.g. as received over the network
+// size    = number of bytes of the encoded image
+// td, data, length = see TopSurf_ExtractDescriptor
+// returns true for success and false for failure. in case of failure a message is
+// printed to stderr.
+// Note: the image is decoded in the same way as an image file on disk, so it is
+//       reduced in size and converted to gray while decoding and it is never copied
+//       in full. this saves writing the image to a temporary file first.
+// Note: TopSurf_Initialized must have been called in order to use this function.
+bool DLLAPI TopSurf_ExtractDescriptorFromMemory(const unsigned char *encoded, size_t size, TOPSURF_DESCRIPTOR &td);
+bool DLLAPI TopSurf_ExtractDescriptorFromMemory(const unsigned char *encoded, size_t size, unsigned char *&data, int &length);
+
+// extract the descriptors of a batch of images
+// fnames = paths to the image files
+// count  = number of image files
+// td     = array of count top surf descriptors, which will contain the detected visual
+//          words in each image sorted by their identifiers
+// returns true for success and false for failure. in case of failure a message is
+// printed to stderr and none of the descriptors are returned.
+// Note: the images are loaded a few at a time, and the interest points of the images
+//       that are loaded together are searched at once, which is faster than extracting
+//       the descriptors one by one. this is meant for (re-)indexing large collections.
+// Note: the time budget does not apply to a batch.
+// Note: TopSurf_Initialized must have been called in order to use this function.
+bool DLLAPI TopSurf_ExtractDescriptors(const char **fnames, int count, TOPSURF_DESCRIPTOR *td);
+
 // choice of similarity measure for comparing descriptors
 enum TOPSURF_SIMILARITY
 {
@@ -173,6 +269,10 @@ bool DLLAPI TopSurf_SaveDescriptor(FILE *file, const unsigned char *data);
 // Note: TopSurf_Initialized does not have to be called in order to use this function.
 bool DLLAPI TopSurf_VisualizeDescriptor(unsigned char *pixels, int dimx, int dimy, TOPSURF_DESCRIPTOR &td);
 bool DLLAPI TopSurf_VisualizeDescriptor(unsigned char *pixels, int dimx, int dimy, const unsigned char *data);
+// same as above, but drawn in place on the pixels of an image in any of the supported
+// pixel formats (see TopSurf_ExtractDescriptor). the points are drawn opaque in the
+// alpha channel, if any
+bool DLLAPI TopSurf_VisualizeDescriptor(const TOPSURF_IMAGEVIEW &view, TOPSURF_DESCRIPTOR &td);
 bool DLLAPI TopSurf_VisualizeDescriptorFromImage(const char *fname, const char *xname, TOPSURF_DESCRIPTOR &td);
 
 // release the memory used by a descriptor
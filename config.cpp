@@ -178,6 +178,65 @@ const char* GetDateAsString(t_date date)
 	return t;
 }
 
+#if defined WIN32 || defined _WIN32 || defined WIN64 || defined _WIN64
+double GetMonotonicTime()
+{
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+#else
+double GetMonotonicTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+#if defined WIN32 || defined _WIN32 || defined WIN64 || defined _WIN64
+void InitializeMutex(t_mutex &mutex)
+{
+	InitializeCriticalSection(&mutex);
+}
+
+void DestroyMutex(t_mutex &mutex)
+{
+	DeleteCriticalSection(&mutex);
+}
+
+void LockMutex(t_mutex &mutex)
+{
+	EnterCriticalSection(&mutex);
+}
+
+void UnlockMutex(t_mutex &mutex)
+{
+	LeaveCriticalSection(&mutex);
+}
+#else
+void InitializeMutex(t_mutex &mutex)
+{
+	pthread_mutex_init(&mutex, NULL);
+}
+
+void DestroyMutex(t_mutex &mutex)
+{
+	pthread_mutex_destroy(&mutex);
+}
+
+void LockMutex(t_mutex &mutex)
+{
+	pthread_mutex_lock(&mutex);
+}
+
+void UnlockMutex(t_mutex &mutex)
+{
+	pthread_mutex_unlock(&mutex);
+}
+#endif
+
 #if !defined WIN32 && !defined _WIN32 && !defined WIN64 && !defined _WIN64
 #include <pwd.h>
 string TildeExpandPath(const string& path)
@@ -42,6 +42,7 @@
 #else
 #include <sys/stat.h>
 #include <dirent.h>
+#include <pthread.h>
 #define _stricmp strcasecmp
 #define _strnicmp strncasecmp
 #define _vsnprintf vsnprintf
@@ -66,6 +67,7 @@ extern int _getch();
 #include <assert.h>
 #include <errno.h>
 #include <iostream>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -113,6 +115,21 @@ typedef time_t t_date;
 extern t_date GetCurrentDate();
 extern const char* GetDateAsString(t_date date);
 
+// get the time in seconds of a clock that never jumps, which is only meaningful
+// when compared to another time of the same clock
+extern double GetMonotonicTime();
+
+// mutual exclusion lock to protect data that is shared between threads
+#if defined WIN32 || defined _WIN32 || defined WIN64 || defined _WIN64
+typedef CRITICAL_SECTION t_mutex;
+#else
+typedef pthread_mutex_t t_mutex;
+#endif
+extern void InitializeMutex(t_mutex &mutex);
+extern void DestroyMutex(t_mutex &mutex);
+extern void LockMutex(t_mutex &mutex);
+extern void UnlockMutex(t_mutex &mutex);
+
 // expand path when it starts with a tilde
 #if !defined WIN32 && !defined _WIN32 && !defined WIN64 && !defined _WIN64
 extern string TildeExpandPath(const string& path);
@@ -27,6 +27,57 @@
 
 #include <stdlib.h>
 
+// presets that determine how the interest points of an image are detected and
+// described
+// Note: the preset is recorded with the dictionary, since the visual words only
+//       make sense for interest points that are extracted in the same way
+// Note: the fast presets only skip the coarsest octave, whose large filters find
+//       few points unless the image dimension is large. at an image dimension of
+//       256 they find nearly the same points as the other presets and save barely
+//       any time, and even at 2048 they save only a few percent. skipping the
+//       orientation stage with the upright presets saves far more
+enum TOPSURF_PRESET
+{
+	TOPSURF_PRESET_FULL,        // rotation invariant descriptors, searched at 4 octaves
+	TOPSURF_PRESET_UPRIGHT,     // upright descriptors (U-SURF), searched at 4 octaves
+	TOPSURF_PRESET_FAST,        // rotation invariant descriptors, searched at 3 octaves
+	TOPSURF_PRESET_FAST_UPRIGHT // upright descriptors (U-SURF), searched at 3 octaves
+};
+
+// formats of the pixels of an image in memory, with 8 bits per channel
+enum TOPSURF_PIXELFORMAT
+{
+	TOPSURF_PIXEL_RGB,  // red, green and blue
+	TOPSURF_PIXEL_BGR,  // blue, green and red, as used by opencv
+	TOPSURF_PIXEL_RGBA, // red, green, blue and alpha, which is ignored
+	TOPSURF_PIXEL_BGRA, // blue, green, red and alpha, which is ignored
+	TOPSURF_PIXEL_GRAY8 // gray
+};
+
+// structure describing the pixels of an image in memory, which are used in place
+// rather than copied
+struct TOPSURF_IMAGEVIEW
+{
+	TOPSURF_IMAGEVIEW(unsigned char *pixels, int width, int height, int stride, TOPSURF_PIXELFORMAT format)
+	{
+		this->pixels = pixels;
+		this->width = width;
+		this->height = height;
+		this->stride = stride;
+		this->format = format;
+	}
+	// the top-left pixel, after which the pixels follow row by row
+	unsigned char *pixels;
+	// dimensions of the image
+	int width;
+	int height;
+	// number of bytes from the start of one row to the start of the next, which
+	// may be more than the pixels of a row take when the rows are padded
+	int stride;
+	// format of the pixels
+	TOPSURF_PIXELFORMAT format;
+};
+
 // structure describing the location of a single visual word element
 struct TOPSURF_LOCATION
 {
@@ -31,7 +31,31 @@
 //       causes the application to crash
 #define FLANN_POINTSMAX			33550000
 
-bool Dictionary::Create(const char *imagedir, int imagedim, int clusters, int knn, int iterations, int points,
+// find the best matching visual word for each feature, where consecutive
+// features are located stride bytes apart from each other
+static bool QuantizeFeatures(const KDTree &kdtree, KDTree::SearchContext &context, const FLANNParameters &kdparam, const char *features, size_t stride, int count, int *indices)
+{
+	if (kdtree.veclen() != OPENSURF_FEATURECOUNT)
+	{
+		SAFE_FLUSHPRINT(stderr, "the kd-tree does not contain SURF features\n");
+		return false;
+	}
+	// the search configuration and result set are prepared only once and
+	// then reused for all features, rather than going through the flann
+	// interface for every single feature
+	int checks = kdparam.checks;
+	KNNResultSet result(1);
+	for (int i = 0; i < count; i++, features += stride)
+	{
+		float *f = (float *)features;
+		result.init(f, OPENSURF_FEATURECOUNT);
+		kdtree.findNeighbors(result, f, checks, context);
+		indices[i] = result.getNeighbors()[0];
+	}
+	return true;
+}
+
+bool Dictionary::Create(const char *imagedir, int imagedim, const OpenSurfParameters &parameters, int clusters, int knn, int iterations, int points,
 		float *&idf, float *&visualwords, KDTree *&kdtree, Dataset<float> *&kddata, FLANNParameters &kdparam)
 {
 	// check parameters
@@ -69,7 +93,7 @@ bool Dictionary::Create(const char *imagedir, int imagedim, int clusters, int kn
 	t_date begin = GetCurrentDate();
 	float *subsetf;
 	int subsetp;
-	if (!DetermineSubset(filenames, imagedim, points, subsetf, subsetp))
+	if (!DetermineSubset(filenames, imagedim, parameters, points, subsetf, subsetp))
 		return false;
 	t_date end = GetCurrentDate();
 	SAFE_FLUSHPRINT(stdout, "%i points extracted\n", subsetp);
@@ -125,7 +149,7 @@ bool Dictionary::Create(const char *imagedir, int imagedim, int clusters, int kn
 	begin = GetCurrentDate();
 	SAFE_FLUSHPRINT(stdout, "creating idf weights...\n");
 	idf = NEW float[clusters];
-	if (!CalculateIDF(filenames, imagedim, clusters, visualwords, *kdtree, kdparam, idf))
+	if (!CalculateIDF(filenames, imagedim, parameters, clusters, visualwords, *kdtree, kdparam, idf))
 	{
 		delete[] idf;
 		delete kdtree;
@@ -242,12 +266,14 @@ void Dictionary::ReadImages(const char *imagedir, vector<string> &filenames)
 #endif
 }
 
-bool Dictionary::DetermineSubset(const vector<string> &filenames, int imagedim, int points, float *&subsetf, int &subsetp)
+bool Dictionary::DetermineSubset(const vector<string> &filenames, int imagedim, const OpenSurfParameters &parameters, int points, float *&subsetf, int &subsetp)
 {
 	// initialize opensurf
 	OpenSurf opensurf(imagedim);
+	opensurf.SetParameters(parameters);
+	OpenSurfWorkspace workspace;
 	// process all images in the directory
-	float *f;
+	const OpenSurfInterestPoint *f;
 	int ip;
 	float *subf = NEW float[filenames.size() * points * OPENSURF_FEATURECOUNT];
 	int subp = 0;
@@ -257,11 +283,11 @@ bool Dictionary::DetermineSubset(const vector<string> &filenames, int imagedim,
 		SAFE_FLUSHPRINT(stdout, "processing image %i\n", i);
 		// load the image
 		const char *fname = (*it).c_str();
-		IplImage *image = cvLoadImage(fname, CV_LOAD_IMAGE_COLOR);
+		IplImage *image = opensurf.LoadImage(fname);
 		if (!image)
 			continue;
 		// extract the features
-		if (!opensurf.ExtractDescriptor(*image, f, ip))
+		if (!opensurf.ExtractDescriptor(*image, workspace, f, ip))
 		{
 			SAFE_FLUSHPRINT(stderr, "could not extract SURF descriptor from %s\n", fname);
 			SAFE_DELETE_ARRAY(subf);
@@ -277,14 +303,13 @@ bool Dictionary::DetermineSubset(const vector<string> &filenames, int imagedim,
 		float *temps = subf + subp * OPENSURF_FEATURECOUNT;
 		ExtractRandomPoints(points, f, temps, ip);
 		subp += ip;
-		SAFE_DELETE_ARRAY(f);
 	}
 	subsetf = subf;
 	subsetp = subp;
 	return true;
 }
 
-void Dictionary::ExtractRandomPoints(int points, const float *src, float *dst, int &ip)
+void Dictionary::ExtractRandomPoints(int points, const OpenSurfInterestPoint *src, float *dst, int &ip)
 {
 	// Note: we assume the caller has ensured that ip is at least 1
 	if (ip > points)
@@ -299,7 +324,7 @@ void Dictionary::ExtractRandomPoints(int points, const float *src, float *dst, i
 		// copy the features of the randomly selected points
 		float *temp = dst;
 		for (int i = 0; i < points; i++, temp += OPENSURF_FEATURECOUNT)
-			memcpy(temp, src + shuffle[i] * OPENSURF_FEATURECOUNT, OPENSURF_FEATURECOUNT * sizeof(float));
+			memcpy(temp, src[shuffle[i]].descriptor, OPENSURF_FEATURECOUNT * sizeof(float));
 		SAFE_DELETE_ARRAY(shuffle);
 		ip = points;
 	}
@@ -307,7 +332,8 @@ void Dictionary::ExtractRandomPoints(int points, const float *src, float *dst, i
 	{
 		// if there are less points than we would like, which will occasionally happen,
 		// use all points
-		memcpy(dst, src, ip * OPENSURF_FEATURECOUNT * sizeof(float));
+		for (int i = 0; i < ip; i++, dst += OPENSURF_FEATURECOUNT)
+			memcpy(dst, src[i].descriptor, OPENSURF_FEATURECOUNT * sizeof(float));
 	}
 }
 
@@ -443,19 +469,21 @@ int Dictionary::DetermineClusterCenters(int clusters, int knn, const float *subs
 	return centersame;
 }
 
-bool Dictionary::CalculateIDF(const vector<string> &filenames, int imagedim, int clusters, const float *visualwords, KDTree &kdtree, FLANNParameters &p, float *idf)
+bool Dictionary::CalculateIDF(const vector<string> &filenames, int imagedim, const OpenSurfParameters &parameters, int clusters, const float *visualwords, KDTree &kdtree, FLANNParameters &p, float *idf)
 {
 	// initialize opensurf
 	OpenSurf opensurf(imagedim);
+	opensurf.SetParameters(parameters);
+	OpenSurfWorkspace workspace;
 	// recalculate the interest points for a fraction of the training images,
 	// as now we want to know which visual words occur in which images and to
 	// be representative we must thus use all interest points of an image
 	// Note: statistically we would need to sample around 2500 images to get
 	//       good idf estimates
-	float *f;
+	const OpenSurfInterestPoint *points;
 	int ip;
-	int index;
-	float dist;
+	vector<int> words;
+	KDTree::SearchContext context(kdtree);
 	int *vwhist = NEW int[clusters];
 	memset(idf, 0, clusters * sizeof(float));
 	int count = 0;
@@ -463,40 +491,36 @@ bool Dictionary::CalculateIDF(const vector<string> &filenames, int imagedim, int
 	for (vector<string>::const_iterator it = filenames.begin(); it != filenames.end(); ++it, i++)
 	{
 		SAFE_FLUSHPRINT(stdout, "processing image %i\n", i);
-		// load the image
+		// extract the features while loading the image
+		// Note: images that cannot be loaded are skipped
 		const char *fname = (*it).c_str();
-		IplImage *image = cvLoadImage(fname, CV_LOAD_IMAGE_COLOR);
-		if (!image)
-			continue;
-		// extract the features
-		if (!opensurf.ExtractDescriptor(*image, f, ip))
+		bool loaded;
+		if (!opensurf.ExtractDescriptor(fname, workspace, points, ip, &loaded))
 		{
+			if (!loaded)
+				continue;
 			SAFE_FLUSHPRINT(stderr, "could not extract SURF descriptor from %s\n", fname);
 			SAFE_DELETE_ARRAY(vwhist);
-			cvReleaseImage(&image);
 			return false;
 		}
-		cvReleaseImage(&image);
 		if (ip == 0)
 			continue;
 		// find the best matching visual word for each interest point
+		words.resize(ip);
+		if (!Quantize(kdtree, context, p, points, ip, &words[0]))
+		{
+			SAFE_FLUSHPRINT(stderr, "could not find best matching visual word in the kd-tree\n");
+			SAFE_DELETE_ARRAY(vwhist);
+			return false;
+		}
 		// Note: for the idf, even if a visual word is detected more than
 		//       once in an image we only count it a single time
-		float *temp = f;
 		memset(vwhist, 0, clusters * sizeof(int));
-		for (int z = 0; z < ip; z++, temp+=OPENSURF_FEATURECOUNT)
+		for (int z = 0; z < ip; z++)
 		{
-			if (flann_find_nearest_neighbors_index(&kdtree, temp, 1, &index, &dist, 1, &p) != 0)
-			{
-				SAFE_FLUSHPRINT(stderr, "could not find best matching visual word in the kd-tree\n");
-				SAFE_DELETE_ARRAY(f);
-				SAFE_DELETE_ARRAY(vwhist);
-				return false;
-			}
-			if (++vwhist[index] == 1)
-				idf[index]++;
+			if (++vwhist[words[z]] == 1)
+				idf[words[z]]++;
 		}
-		SAFE_DELETE_ARRAY(f);
 		// check if we have processed enough images
 		if (++count == 2500)
 			break;
@@ -527,7 +551,19 @@ void Dictionary::GetFLANNParameters(FLANNParameters &kdparam)
 	kdparam.log_destination = NULL; // print to console
 }
 
-bool Dictionary::LoadSize(const char *fname, int &clusters)
+bool Dictionary::Quantize(const KDTree &kdtree, KDTree::SearchContext &context, const FLANNParameters &kdparam, const float *features, int count, int *indices)
+{
+	return QuantizeFeatures(kdtree, context, kdparam, (const char *)features, OPENSURF_FEATURECOUNT * sizeof(float), count, indices);
+}
+
+bool Dictionary::Quantize(const KDTree &kdtree, KDTree::SearchContext &context, const FLANNParameters &kdparam, const OpenSurfInterestPoint *points, int count, int *indices)
+{
+	if (count <= 0)
+		return true;
+	return QuantizeFeatures(kdtree, context, kdparam, (const char *)points->descriptor, sizeof(OpenSurfInterestPoint), count, indices);
+}
+
+bool Dictionary::LoadSize(const char *fname, int &clusters, string &preset)
 {
 	FILE *file = fopen(fname, "r");
 	if (file == NULL)
@@ -543,8 +579,16 @@ bool Dictionary::LoadSize(const char *fname, int &clusters)
 		fclose(file);
 		return false;
 	}
-	fclose(file);
 	clusters = atoi(line);
+	// the preset is on the second line, if any
+	preset.clear();
+	if (SAFE_GETLINE(line, sizeof(line), length, file))
+	{
+		if (length > 0 && line[length-1] == '\r')
+			line[--length] = '\0';
+		preset = line;
+	}
+	fclose(file);
 	if (clusters <= 0)
 	{
 		SAFE_FLUSHPRINT(stderr, "invalid data in %s\n", fname);
@@ -553,7 +597,7 @@ bool Dictionary::LoadSize(const char *fname, int &clusters)
 	return true;
 }
 
-bool Dictionary::SaveSize(const char *fname, int clusters)
+bool Dictionary::SaveSize(const char *fname, int clusters, const char *preset)
 {
 	FILE *file = fopen(fname, "w");
 	if (file == NULL)
@@ -561,7 +605,7 @@ bool Dictionary::SaveSize(const char *fname, int clusters)
 		SAFE_FLUSHPRINT(stderr, "could not open %s for read\n", fname);
 		return false;
 	}
-	SAFE_FLUSHPRINT(file, "%i", clusters);
+	SAFE_FLUSHPRINT(file, "%i\n%s", clusters, preset);
 	fclose(file);
 	return true;
 }
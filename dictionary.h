@@ -28,34 +28,46 @@
 #include "config.h"
 #include "flann/flann.h"
 #include "flann/kdtree.h"
+#include "ipoint.h"
+#include "opensurf.h"
 
 class Dictionary
 {
 public:
 	// create a dictionary
-	static bool Create(const char *imagedir, int imagedim, int clusters, int knn, int iterations, int points,
+	static bool Create(const char *imagedir, int imagedim, const OpenSurfParameters &parameters, int clusters, int knn, int iterations, int points,
 		float *&idf, float *&visualwords, KDTree *&kdtree, Dataset<float> *&kddata, FLANNParameters &kdparam);
 private:
 	// read images from image directory and its subdirectories
 	static void ReadImages(const char *imagedir, vector<string> &filenames);
 	// determine subset of interest points
-	static bool DetermineSubset(const vector<string> &filenames, int imagedim, int points, float *&subsetf, int &subsetp);
+	static bool DetermineSubset(const vector<string> &filenames, int imagedim, const OpenSurfParameters &parameters, int points, float *&subsetf, int &subsetp);
 	// extract random points
-	static void ExtractRandomPoints(int points, const float *src, float *dst, int &ip);
+	static void ExtractRandomPoints(int points, const OpenSurfInterestPoint *src, float *dst, int &ip);
 	// perform the clustering
 	static bool PerformClustering(int clusters, int knn, int iterations, const float *subsetf, int subsetp, float *visualwords, KDTree &kdtree, FLANNParameters &p);
 	// determine new cluster centers
 	static int DetermineClusterCenters(int clusters, int knn, const float *subsetf, const int *indices, const float *dists, float *centers);
 	// calculate idf weights
-	static bool CalculateIDF(const vector<string> &filenames, int imagedim, int clusters, const float *visualwords, KDTree &kdtree, FLANNParameters &p, float *idf);
+	static bool CalculateIDF(const vector<string> &filenames, int imagedim, const OpenSurfParameters &parameters, int clusters, const float *visualwords, KDTree &kdtree, FLANNParameters &p, float *idf);
 	// get flann parameters
 	static void GetFLANNParameters(FLANNParameters &kdparam);
 
 public:
-	// load size of dictionary
-	static bool LoadSize(const char *fname, int &clusters);
-	// save size of dictionary
-	static bool SaveSize(const char *fname, int clusters);
+	// find the best matching visual word for each of the features, which are stored
+	// one after the other, e.g. those of one image or those of many images in a row
+	// Note: the kdtree is only read, so multiple threads can quantize against the
+	//       same kdtree at once as long as each thread uses its own search context
+	static bool Quantize(const KDTree &kdtree, KDTree::SearchContext &context, const FLANNParameters &kdparam, const float *features, int count, int *indices);
+	// find the best matching visual word for each of the interest points
+	static bool Quantize(const KDTree &kdtree, KDTree::SearchContext &context, const FLANNParameters &kdparam, const OpenSurfInterestPoint *points, int count, int *indices);
+
+public:
+	// load size of dictionary and the name of the extraction preset it was created
+	// with, which is empty for dictionaries that were created before presets existed
+	static bool LoadSize(const char *fname, int &clusters, string &preset);
+	// save size of dictionary and the name of the extraction preset
+	static bool SaveSize(const char *fname, int clusters, const char *preset);
 	// load kdtree
 	static bool LoadKDTree(const char *fname, int clusters, float *visualwords, KDTree *&kdtree, Dataset<float> *&kddata, FLANNParameters &kdparam);
 	// save kdtree
@@ -11,20 +11,272 @@
 #include "fasthessian.h"
 
 #include "integral.h"
+#include "threadpool.h"
 
-//! Round float to nearest integer
-inline int fRound(float flt)
-{
-	return (int) floor(flt+0.5f);
-}
-
-//-------------------------------------------------------
 // pre calculated lobe sizes
 static const int lobe_cache [] = {3,5,7,9,5,9,13,17,9,17,25,33,17,33,49,65};
 static const int lobe_cache_unique [] = {3,5,7,9,13,17,25,33,49,65};
 static const int lobe_map [] = {0,1,2,3,1,3,4,5,3,5,6,7,5,7,8,9};
 static const int border_cache [] = {14,26,50,98}; 
 
+//-------------------------------------------------------
+// conversion of the determinant of hessian responses to and from their storage
+
+#ifdef OPENSURF_HALF_DET
+//! Convert a float to half precision, rounding to the nearest value
+inline DetValue storeDet(float flt)
+{
+	unsigned int x;
+	memcpy(&x, &flt, sizeof(x));
+	unsigned int sign = (x >> 16) & 0x8000;
+	int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+	unsigned int mant = x & 0x7fffff;
+
+	// overflow to infinity, and keep not-a-number
+	if (exp >= 31)
+		return (DetValue)(sign | 0x7c00 | (((x & 0x7fffffff) > 0x7f800000) ? 0x200 : 0));
+
+	// denormals and underflow to zero
+	if (exp <= 0)
+	{
+		if (exp < -10)
+			return (DetValue)sign;
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		unsigned int half = mant >> shift;
+		unsigned int rest = mant & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return (DetValue)(sign | half);
+	}
+
+	unsigned int half = sign | (exp << 10) | (mant >> 13);
+	unsigned int rest = mant & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return (DetValue)half;
+}
+
+//! Convert a half precision value back to a float
+inline float loadDet(DetValue val)
+{
+	unsigned int sign = (val & 0x8000) << 16;
+	int exp = (val >> 10) & 0x1f;
+	unsigned int mant = val & 0x3ff;
+	unsigned int x;
+
+	if (exp == 0)
+	{
+		if (mant == 0)
+			x = sign;
+		else
+		{
+			// normalise the denormal
+			exp = 1;
+			while (!(mant & 0x400))
+			{
+				mant <<= 1;
+				exp--;
+			}
+			mant &= 0x3ff;
+			x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+		}
+	}
+	else if (exp == 31)
+		x = sign | 0x7f800000 | (mant << 13);
+	else
+		x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+
+	float flt;
+	memcpy(&flt, &x, sizeof(flt));
+	return flt;
+}
+#else
+inline DetValue storeDet(float flt) { return flt; }
+inline float loadDet(DetValue val) { return val; }
+#endif
+
+//-------------------------------------------------------
+// determinant of hessian layers specialized for the common configurations
+
+//! Calculate the responses of the rows from first up to but not including last
+//! of a layer with lobe L, sampling step STEP and border BORDER, in an integral
+//! image of WIDTH pixels wide without padding. This is the same as buildDetRows,
+//! except that the filter sizes, steps and bounds are all known at compile time
+template <int L, int STEP, int BORDER, int WIDTH>
+void buildLayerFixed(const float *data, DetValue *det, int first, int last)
+{
+	enum 
+	{
+		W = 3 * L,
+		B = W / 2,
+		END = WIDTH - BORDER,
+		COLS = WIDTH > 2 * BORDER ? (WIDTH - 2 * BORDER + STEP - 1) / STEP : 0
+	};
+	const float inverse_area = 1.0f/(W * W);
+
+	// Dxx
+	typedef FixedBox<-L + 1, -B, 2*L - 1, W, WIDTH> Box0;
+	typedef FixedBox<-L + 1, -L / 2, 2*L - 1, L, WIDTH> Box1;
+	// Dyy
+	typedef FixedBox<-B, -L + 1, W, 2*L - 1, WIDTH> Box2;
+	typedef FixedBox<-L / 2, -L + 1, L, 2*L - 1, WIDTH> Box3;
+	// Dxy
+	typedef FixedBox<-L, 1, L, L, WIDTH> Box4;
+	typedef FixedBox<1, -L, L, L, WIDTH> Box5;
+	typedef FixedBox<-L, -L, L, L, WIDTH> Box6;
+	typedef FixedBox<1, 1, L, L, WIDTH> Box7;
+
+	for(int r = BORDER + first * STEP; r < BORDER + last * STEP; r += STEP, det += COLS) 
+	{
+		int c = BORDER;
+		DetValue *d = det;
+#ifdef OPENSURF_SSE2
+		// calculate four responses at a time
+		const __m128 inv4 = _mm_set1_ps(inverse_area);
+		const __m128 three4 = _mm_set1_ps(3.0f);
+		const __m128 scale4 = _mm_set1_ps(0.81f);
+		const __m128 sign4 = _mm_set1_ps(-0.0f);
+		for(; c + 3*STEP < END; c += 4*STEP) 
+		{
+			const float *p = data + r*WIDTH + c;
+
+			__m128 Dxx = _mm_sub_ps(Box0::template sum4<STEP>(p), _mm_mul_ps(Box1::template sum4<STEP>(p), three4));
+			__m128 Dyy = _mm_sub_ps(Box2::template sum4<STEP>(p), _mm_mul_ps(Box3::template sum4<STEP>(p), three4));
+			__m128 Dxy = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(Box4::template sum4<STEP>(p), Box5::template sum4<STEP>(p)), 
+				Box6::template sum4<STEP>(p)), Box7::template sum4<STEP>(p));
+
+			// Normalise the filter responses with respect to their size
+			Dxx = _mm_mul_ps(Dxx, inv4);
+			Dyy = _mm_mul_ps(Dyy, inv4);
+			Dxy = _mm_mul_ps(Dxy, inv4);
+
+			// Get the determinant of hessian response, and flip its sign
+			// where the sign of the laplacian is negative
+			__m128 determinant = _mm_sub_ps(_mm_mul_ps(Dxx, Dyy), _mm_mul_ps(_mm_mul_ps(scale4, Dxy), Dxy));
+			__m128 negative = _mm_cmplt_ps(_mm_add_ps(Dxx, Dyy), _mm_setzero_ps());
+			__m128 response = _mm_xor_ps(determinant, _mm_and_ps(negative, sign4));
+			response = _mm_and_ps(response, _mm_cmpge_ps(determinant, _mm_setzero_ps()));
+
+#ifdef OPENSURF_HALF_DET
+			float res[4];
+			_mm_storeu_ps(res, response);
+			for(int j=0; j<4; j++) 
+				d[j] = storeDet(res[j]);
+#else
+			_mm_storeu_ps(d, response);
+#endif
+			d += 4;
+		}
+#endif
+		for(; c < END; c += STEP, d++) 
+		{
+			const float *p = data + r*WIDTH + c;
+
+			float Dxx = Box0::sum(p) - Box1::sum(p)*3;
+			float Dyy = Box2::sum(p) - Box3::sum(p)*3;
+			float Dxy = + Box4::sum(p) + Box5::sum(p) - Box6::sum(p) - Box7::sum(p);
+
+			// Normalise the filter responses with respect to their size
+			Dxx *= inverse_area;
+			Dyy *= inverse_area;
+			Dxy *= inverse_area;
+
+			// Get the sign of the laplacian
+			int lap_sign = (Dxx+Dyy >= 0 ? 1 : -1);
+
+			// Get the determinant of hessian response
+			float determinant = (Dxx*Dyy - 0.81f*Dxy*Dxy);
+
+			*d = storeDet(determinant < 0 ? 0 : lap_sign * determinant);
+		}
+	}
+}
+
+//! Lobe, sampling step, border and image width of a layer with a specialized
+//! kernel
+struct FixedLayer
+{
+	int lobe, step, border, width;
+	FastHessian::LayerKernel kernel;
+};
+
+//! The layers of the default parameters, and therefore also of fewer octaves 
+//! or intervals, at the common image dimensions
+#define FIXED_LAYER(L, STEP, BORDER, WIDTH) \
+	{ L, STEP, BORDER, WIDTH, buildLayerFixed<L, STEP, BORDER, WIDTH> }
+#define FIXED_LAYERS(WIDTH) \
+	FIXED_LAYER(3, 2, 14, WIDTH), FIXED_LAYER(5, 2, 14, WIDTH), \
+	FIXED_LAYER(7, 2, 14, WIDTH), FIXED_LAYER(9, 2, 14, WIDTH), \
+	FIXED_LAYER(13, 4, 26, WIDTH), FIXED_LAYER(17, 4, 26, WIDTH), \
+	FIXED_LAYER(25, 8, 50, WIDTH), FIXED_LAYER(33, 8, 50, WIDTH), \
+	FIXED_LAYER(49, 16, 98, WIDTH), FIXED_LAYER(65, 16, 98, WIDTH)
+
+static const FixedLayer fixed_layers[] = 
+{
+	FIXED_LAYERS(128),
+	FIXED_LAYERS(256),
+	FIXED_LAYERS(512)
+};
+
+#undef FIXED_LAYERS
+#undef FIXED_LAYER
+
+//-------------------------------------------------------
+
+//! Calculates the responses or finds the features of a range of rows of a
+//! FastHessian object
+class FastHessianTask : public ThreadTask
+{
+public:
+	FastHessianTask(FastHessian &fh, bool suppress, int first) 
+		: fh(fh), suppress(suppress), first(first) {}
+
+	void Execute(int begin, int end)
+	{
+		begin += first;
+		end += first;
+		if (suppress)
+		{
+			for(int k = begin; k < end; k++) 
+				fh.suppressRow(k, fh.suppression_ipts[k]);
+		}
+		else
+			fh.buildDetRows(begin, end);
+	}
+
+private:
+	FastHessian &fh;
+	bool suppress;
+	int first;
+};
+
+#ifdef OPENSURF_SSE2
+//! Calculates the responses of a range of rows of a batch of FastHessian
+//! objects from their interleaved integral images
+class FastHessianBatchTask : public ThreadTask
+{
+public:
+	FastHessianBatchTask(FastHessian **batch, int count, const float *data) 
+		: batch(batch), count(count), data(data) {}
+
+	void Execute(int begin, int end)
+	{
+		FastHessian::buildBatchRows(batch, count, data, begin, end);
+	}
+
+private:
+	FastHessian **batch;
+	int count;
+	const float *data;
+};
+#endif
+
+//-------------------------------------------------------
+
+const int FastHessian::BATCH_LANES;
+
 //-------------------------------------------------------
 
 //! Destructor
@@ -75,6 +327,48 @@ void FastHessian::saveParameters(const int octaves, const int intervals,
 	this->init_sample = 
 		(init_sample > 0 && init_sample <= 6 ? init_sample : INIT_SAMPLE);
 	this->thres = (thres >= 0 ? thres : THRES);
+
+	// Force the layers to be reallocated for the next image
+	i_width = i_height = 0;
+
+	// The same filter sizes appear in several octaves. Their responses only 
+	// need to be calculated once, at the finest sampling step, as long as the
+	// sample grids of the coarser octaves are contained in the finer grid.
+	layers = 0;
+	for(int o=0; o < this->octaves; o++) 
+	{
+		// For each octave double the sampling step of the previous
+		octave_step[o] = this->init_sample << o;
+
+		int step = octave_step[o];
+		int border = border_cache[o];
+
+		for(int i=0; i < this->intervals; i++) 
+		{
+			int filter = lobe_map[o*this->intervals + i];
+			int lobe = lobe_cache_unique[filter];
+
+			// find a finer layer with the same filter and a matching sample grid
+			int layer = 0;
+			for(; layer < layers; layer++) 
+			{
+				if (layer_lobe[layer] == lobe && step % layer_step[layer] == 0 
+					&& border >= layer_border[layer] 
+					&& (border - layer_border[layer]) % layer_step[layer] == 0)
+					break;
+			}
+
+			// otherwise the filter gets a layer of its own
+			if (layer == layers) 
+			{
+				layer_lobe[layer] = lobe;
+				layer_step[layer] = step;
+				layer_border[layer] = border;
+				layers++;
+			}
+			layer_map[o*this->intervals + i] = layer;
+		}
+	}
 }
 
 
@@ -92,116 +386,406 @@ void FastHessian::setIntImage(IplImage *img)
 		i_width = img->width;
 		i_height = img->height;
 
+		// Work out the size of each layer, which only has to hold the 
+		// responses at the sampled positions inside its border
+		int m_det_size = 0;
+		det_rows = 0;
+		for(int k=0; k<layers; k++) 
+		{
+			const int step = layer_step[k];
+			const int border = layer_border[k];
+			layer_offset[k] = m_det_size;
+			layer_cols[k] = std::max(0, (i_width - 2*border + step - 1) / step);
+			layer_rows[k] = std::max(0, (i_height - 2*border + step - 1) / step);
+			layer_first[k] = det_rows;
+			m_det_size += layer_cols[k] * layer_rows[k];
+			det_rows += layer_rows[k];
+
+			// Look for a kernel specialized for this layer
+			layer_kernel[k] = NULL;
+			for(size_t j = 0; j < sizeof(fixed_layers) / sizeof(fixed_layers[0]); j++) 
+			{
+				const FixedLayer &fixed = fixed_layers[j];
+				if (fixed.lobe == layer_lobe[k] && fixed.step == step 
+					&& fixed.border == border && fixed.width == i_width)
+				{
+					layer_kernel[k] = fixed.kernel;
+					break;
+				}
+			}
+		}
+
+		// Work out the rows of non-max suppression blocks of each octave
+		suppression_rows.clear();
+		for(int o=0; o < octaves; o++) 
+		{
+			octave_first[o] = (int)suppression_rows.size();
+			int step = octave_step[o];
+			int border = border_cache[o];
+
+			for(int i = 1; i < intervals-1; i += 2) 
+			{
+				for(int r = border; r < i_height - border; r += 2*step) 
+				{
+					SuppressionRow row = { o, i, r };
+					suppression_rows.push_back(row);
+				}
+			}
+		}
+		octave_first[octaves] = (int)suppression_rows.size();
+
 		// Allocate space for determinant of hessian pyramid 
 		if (m_det) delete [] m_det;
-		const int m_det_size = octaves*intervals*i_width*i_height;
-		m_det = new float [m_det_size];
-		memset(m_det,0,m_det_size*sizeof(float));
+		m_det = new DetValue [std::max(m_det_size, 1)];
+		memset(m_det,0,std::max(m_det_size, 1)*sizeof(DetValue));
 	}
 }
 
 //-------------------------------------------------------
 
 //! Find the image features and write into vector of features
-void FastHessian::getIpoints()
+int FastHessian::getIpoints(ThreadPool *pool, double deadline, int enough)
 {
 	// Clear the vector of exisiting ipts
 	ipts.clear();
 
-	// Calculate approximated determinant of hessian values
-	buildDet();
+	if (deadline <= 0)
+	{
+		// Calculate approximated determinant of hessian values
+		buildDet(pool, 0, det_rows);
+
+		suppress(pool, 0, (int)suppression_rows.size());
+		return (int)ipts.size();
+	}
 
-	for(int o=0; o < octaves; o++) 
+	// Search the octaves from coarse to fine, calculating the layers each
+	// octave needs just before it is searched, until time is up and some
+	// features were found. Each finer octave costs about four times as much
+	// as the one before, so an octave is skipped when the time per response
+	// of the previous octave says it would not be finished in time
+	bool built[OCTAVES*INTERVALS] = { false };
+	int found = 0;
+	double start = GetMonotonicTime();
+	double rate = 0;
+	for(int o = octaves-1; o >= 0; o--) 
 	{
-		// For each octave double the sampling step of the previous
-		int step = init_sample * fRound(pow(2.0f,o));
-		int border = border_cache[o];
+		// Estimate the cost by the responses that are calculated and the
+		// responses that are searched
+		double cost = 0;
+		for(int i = 0; i < intervals; i++) 
+		{
+			const int k = layer_map[o*intervals + i];
+			cost += (built[k] ? 1.0 : 2.0) * layer_cols[k] * layer_rows[k];
+		}
+		if (found > 0 && start + rate * cost >= deadline)
+			break;
 
-		// 3x3x3 non-max suppression over whole image
-		for(int i = 1; i < intervals-1; i += 2) {
-			for(int r = border; r < i_height - border; r += 2*step) {
-				for(int c = border; c < i_width - border; c += 2*step) {
-
-					int i_max = -1, r_max = -1, c_max = -1;
-					float max_val = 0;
-
-					// Scan the pixels in this block to find the local extremum.
-					for (int ii = i; ii < min(i+2, intervals-1); ii += 1) {
-						for (int rr = r; rr < min(r+2*step, i_height - border); rr += step) {
-							for (int cc = c; cc < min(c+2*step, i_width - border); cc += step) {
-
-								float val = getVal(o, ii, cc, rr);
-
-								// record the max value and its location
-								if (val > max_val) 
-								{
-									max_val = val;
-									i_max = ii;
-									r_max = rr;
-									c_max = cc;
-								}
-							}
-						}
-					}
+		for(int i = 0; i < intervals; i++) 
+		{
+			const int k = layer_map[o*intervals + i];
+			if (!built[k]) 
+			{
+				buildDet(pool, layer_first[k], layer_first[k] + layer_rows[k]);
+				built[k] = true;
+			}
+		}
+
+		suppress(pool, octave_first[o], octave_first[o+1]);
+
+		const double now = GetMonotonicTime();
+		rate = (now - start) / std::max(cost, 1.0);
+		start = now;
 
-					// Check the block extremum is an extremum across boundaries.
-					if (max_val > thres && i_max != -1 && isExtremum(o, i_max, c_max, r_max)) 
+		if (found == 0)
+			found = (int)ipts.size();
+		if (found > 0 && ((enough > 0 && (int)ipts.size() >= enough) || now >= deadline))
+			break;
+	}
+
+	return found;
+}
+
+//-------------------------------------------------------
+
+//! Find the image features of a batch of images
+void FastHessian::getBatchIpoints(FastHessian **batch, int count, std::vector<float> &data, ThreadPool *pool)
+{
+#ifdef OPENSURF_SSE2
+	for(int j = 0; j < count; j += BATCH_LANES) 
+	{
+		FastHessian **group = batch + j;
+		const int lanes = std::min(count - j, BATCH_LANES);
+
+		// Only images with the same layout of responses can share the lanes
+		bool same = lanes > 1;
+		for(int n = 1; n < lanes && same; n++) 
+			same = group[0]->sameLayout(*group[n]);
+		if (!same)
+		{
+			for(int n = 0; n < lanes; n++) 
+				group[n]->getIpoints(pool);
+			continue;
+		}
+
+		// Interleave the integral images, where unused lanes are cleared
+		// since the buffer still holds the images of the previous batch
+		const int width = group[0]->i_width;
+		const int height = group[0]->i_height;
+		data.resize(std::max(width * height * BATCH_LANES, 1));
+		for(int n = 0; n < BATCH_LANES; n++) 
+		{
+			const IplImage *img = n < lanes ? group[n]->img : NULL;
+			for(int y = 0; y < height; y++) 
+			{
+				float *dst = &data[y * width * BATCH_LANES + n];
+				if (img)
+				{
+					const float *src = (const float *)(img->imageData + y * img->widthStep);
+					for(int x = 0; x < width; x++, dst += BATCH_LANES) 
+						*dst = src[x];
+				}
+				else
+				{
+					for(int x = 0; x < width; x++, dst += BATCH_LANES) 
+						*dst = 0.0f;
+				}
+			}
+		}
+
+		// Calculate approximated determinant of hessian values of all images
+		const int rows = group[0]->det_rows;
+		if (pool && pool->GetThreadCount() > 1)
+		{
+			FastHessianBatchTask task(group, lanes, &data[0]);
+			pool->Run(task, rows);
+		}
+		else
+			buildBatchRows(group, lanes, &data[0], 0, rows);
+
+		for(int n = 0; n < lanes; n++) 
+		{
+			group[n]->ipts.clear();
+			group[n]->suppress(pool, 0, (int)group[n]->suppression_rows.size());
+		}
+	}
+#else
+	for(int j = 0; j < count; j++) 
+		batch[j]->getIpoints(pool);
+#endif
+}
+
+//-------------------------------------------------------
+
+//! Check whether the responses are laid out the same as those of another
+bool FastHessian::sameLayout(const FastHessian &other) const
+{
+	return octaves == other.octaves && intervals == other.intervals 
+		&& init_sample == other.init_sample 
+		&& i_width == other.i_width && i_height == other.i_height;
+}
+
+//-------------------------------------------------------
+
+//! Find the image features in a range of rows of non-max suppression blocks
+void FastHessian::suppress(ThreadPool *pool, int begin, int end)
+{
+	if (pool && pool->GetThreadCount() > 1)
+	{
+		// Every row of blocks gets its own features, which are added in the
+		// same order as when the rows are searched one after the other
+		suppression_ipts.resize(suppression_rows.size());
+		for(int k = begin; k < end; k++) 
+			suppression_ipts[k].clear();
+
+		FastHessianTask task(*this, true, begin);
+		pool->Run(task, end - begin);
+
+		for(int k = begin; k < end; k++) 
+			ipts.insert(ipts.end(), suppression_ipts[k].begin(), suppression_ipts[k].end());
+	}
+	else
+	{
+		for(int k = begin; k < end; k++) 
+			suppressRow(k, ipts);
+	}
+}
+
+//-------------------------------------------------------
+
+//! Find the image features in a row of non-max suppression blocks
+void FastHessian::suppressRow(int row, std::vector<OpenSurfInterestPoint> &points)
+{
+	const int o = suppression_rows[row].octave;
+	const int i = suppression_rows[row].interval;
+	const int r = suppression_rows[row].row;
+
+	int step = octave_step[o];
+	int border = border_cache[o];
+
+	// 3x3x3 non-max suppression over whole image
+	for(int c = border; c < i_width - border; c += 2*step) {
+
+		int i_max = -1, r_max = -1, c_max = -1;
+		float max_val = 0;
+
+		// Scan the pixels in this block to find the local extremum.
+		for (int ii = i; ii < min(i+2, intervals-1); ii += 1) {
+			for (int rr = r; rr < min(r+2*step, i_height - border); rr += step) {
+				for (int cc = c; cc < min(c+2*step, i_width - border); cc += step) {
+
+					float val = getVal(o, ii, cc, rr);
+
+					// record the max value and its location
+					if (val > max_val) 
 					{
-						interpolateExtremum(o, i_max, r_max, c_max);
+						max_val = val;
+						i_max = ii;
+						r_max = rr;
+						c_max = cc;
 					}
 				}
 			}
-		}  
+		}
+
+		// Check the block extremum is an extremum across boundaries.
+		if (max_val > thres && i_max != -1 && isExtremum(o, i_max, c_max, r_max)) 
+		{
+			interpolateExtremum(o, i_max, r_max, c_max, points);
+		}
+	}
+}
+
+//-------------------------------------------------------
+
+//! Calculate determinant of hessian responses of a range of rows, where the
+//! rows of all layers are counted one after the other
+void FastHessian::buildDet(ThreadPool *pool, int begin, int end)
+{
+	// The rows of all layers are independent of each other
+	if (pool && pool->GetThreadCount() > 1)
+	{
+		FastHessianTask task(*this, false, begin);
+		pool->Run(task, end - begin);
 	}
+	else
+		buildDetRows(begin, end);
 }
 
 //-------------------------------------------------------
 
-//! Calculate determinant of hessian responses
-void FastHessian::buildDet()
+//! Calculate determinant of hessian responses of a range of rows
+//! Note: the borders are large enough for the biggest filter of each octave,
+//! so none of the boxes ever reach outside of the integral image and their
+//! sums can be calculated without the bounds checks of BoxIntegral
+void FastHessian::buildDetRows(int begin, int end)
 {
 	int l, w, b, border, step;
-	float Dxx, Dyy, Dxy, inverse_area;
+	float inverse_area;
+	BoxCorners box[8];
+
+	const float *data = (const float *) img->imageData;
+	const int i_step = img->widthStep/sizeof(float);
 
-	for(int o=0; o<octaves; o++) 
+	for(int k=0; k<layers; k++) 
 	{
-		step = init_sample * fRound(pow(2.0f,o));
-		border = border_cache[o];
+		// Only the rows of this layer that lie within the range
+		const int first = std::max(begin, layer_first[k]) - layer_first[k];
+		const int last = std::min(end, layer_first[k] + layer_rows[k]) - layer_first[k];
+		if (first >= last)
+			continue;
+
+		// Use the kernel specialized for this layer when there is one, which
+		// requires the integral image rows to be without padding
+		if (layer_kernel[k] && i_step == i_width)
+		{
+			layer_kernel[k](data, m_det + layer_offset[k] + first * layer_cols[k], first, last);
+			continue;
+		}
 
-		for(int i=0; i<intervals; i++) {
+		step = layer_step[k];
+		border = layer_border[k];
+
+		l = layer_lobe[k]; 
+		w = 3 * l;                      
+		b = w / 2;        
+		inverse_area = 1.0f/(w * w);     
+
+		// Dxx
+		box[0].set(-l + 1, -b, 2*l - 1, w, i_step);
+		box[1].set(-l + 1, -l / 2, 2*l - 1, l, i_step);
+		// Dyy
+		box[2].set(-b, -l + 1, w, 2*l - 1, i_step);
+		box[3].set(-l / 2, -l + 1, l, 2*l - 1, i_step);
+		// Dxy
+		box[4].set(-l, 1, l, l, i_step);
+		box[5].set(1, -l, l, l, i_step);
+		box[6].set(-l, -l, l, l, i_step);
+		box[7].set(1, 1, l, l, i_step);
+
+		DetValue *det = m_det + layer_offset[k] + first * layer_cols[k];
+
+		for(int r = border + first * step; r < border + last * step; r += step, det += layer_cols[k]) 
+		{
+			int c = border;
+			DetValue *d = det;
+#ifdef OPENSURF_SSE2
+			// calculate four responses at a time
+			const __m128 inv4 = _mm_set1_ps(inverse_area);
+			const __m128 three4 = _mm_set1_ps(3.0f);
+			const __m128 scale4 = _mm_set1_ps(0.81f);
+			const __m128 sign4 = _mm_set1_ps(-0.0f);
+			for(; c + 3*step < i_width - border; c += 4*step) 
+			{
+				const float *p = data + r*i_step + c;
+
+				__m128 Dxx = _mm_sub_ps(box[0].sum4(p, step), _mm_mul_ps(box[1].sum4(p, step), three4));
+				__m128 Dyy = _mm_sub_ps(box[2].sum4(p, step), _mm_mul_ps(box[3].sum4(p, step), three4));
+				__m128 Dxy = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(box[4].sum4(p, step), box[5].sum4(p, step)), 
+					box[6].sum4(p, step)), box[7].sum4(p, step));
+
+				// Normalise the filter responses with respect to their size
+				Dxx = _mm_mul_ps(Dxx, inv4);
+				Dyy = _mm_mul_ps(Dyy, inv4);
+				Dxy = _mm_mul_ps(Dxy, inv4);
+
+				// Get the determinant of hessian response, and flip its sign
+				// where the sign of the laplacian is negative
+				__m128 determinant = _mm_sub_ps(_mm_mul_ps(Dxx, Dyy), _mm_mul_ps(_mm_mul_ps(scale4, Dxy), Dxy));
+				__m128 negative = _mm_cmplt_ps(_mm_add_ps(Dxx, Dyy), _mm_setzero_ps());
+				__m128 response = _mm_xor_ps(determinant, _mm_and_ps(negative, sign4));
+				response = _mm_and_ps(response, _mm_cmpge_ps(determinant, _mm_setzero_ps()));
+
+#ifdef OPENSURF_HALF_DET
+				float res[4];
+				_mm_storeu_ps(res, response);
+				for(int j=0; j<4; j++) 
+					d[j] = storeDet(res[j]);
+#else
+				_mm_storeu_ps(d, response);
+#endif
+				d += 4;
+			}
+#endif
+			for(; c < i_width - border; c += step, d++) 
+			{
+				const float *p = data + r*i_step + c;
 
-			l = lobe_cache[o*intervals + i]; 
-			w = 3 * l;                      
-			b = w / 2;        
-			inverse_area = 1.0f/(w * w);     
+				float Dxx = box[0].sum(p) - box[1].sum(p)*3;
+				float Dyy = box[2].sum(p) - box[3].sum(p)*3;
+				float Dxy = + box[4].sum(p) + box[5].sum(p) - box[6].sum(p) - box[7].sum(p);
 
-			for(int r = border; r < i_height - border; r += step) 
-			{
-				for(int c = border; c < i_width - border; c += step) 
-				{
-					Dxx = BoxIntegral(img, r - l + 1, c - b, 2*l - 1, w)
-						- BoxIntegral(img, r - l + 1, c - l / 2, 2*l - 1, l)*3;
-					Dyy = BoxIntegral(img, r - b, c - l + 1, w, 2*l - 1)
-						- BoxIntegral(img, r - l / 2, c - l + 1, l, 2*l - 1)*3;
-					Dxy = + BoxIntegral(img, r - l, c + 1, l, l)
-						+ BoxIntegral(img, r + 1, c - l, l, l)
-						- BoxIntegral(img, r - l, c - l, l, l)
-						- BoxIntegral(img, r + 1, c + 1, l, l);
-
-					// Normalise the filter responses with respect to their size
-					Dxx *= inverse_area;
-					Dyy *= inverse_area;
-					Dxy *= inverse_area;
-
-					// Get the sign of the laplacian
-					int lap_sign = (Dxx+Dyy >= 0 ? 1 : -1);
-
-					// Get the determinant of hessian response
-					float determinant = (Dxx*Dyy - 0.81f*Dxy*Dxy);
-
-					m_det[(o*intervals+i)*(i_width*i_height) + (r*i_width+c)] 
-					= (determinant < 0 ? 0 : lap_sign * determinant);
-				}
+				// Normalise the filter responses with respect to their size
+				Dxx *= inverse_area;
+				Dyy *= inverse_area;
+				Dxy *= inverse_area;
+
+				// Get the sign of the laplacian
+				int lap_sign = (Dxx+Dyy >= 0 ? 1 : -1);
+
+				// Get the determinant of hessian response
+				float determinant = (Dxx*Dyy - 0.81f*Dxy*Dxy);
+
+				*d = storeDet(determinant < 0 ? 0 : lap_sign * determinant);
 			}
 		}
 	}
@@ -209,10 +793,96 @@ void FastHessian::buildDet()
 
 //-------------------------------------------------------
 
+#ifdef OPENSURF_SSE2
+//! Calculate the responses of a range of rows of a batch of images, which is
+//! the same as buildDetRows except that every lane holds another image
+void FastHessian::buildBatchRows(FastHessian **batch, int count, const float *data, int begin, int end)
+{
+	int l, w, b, border, step;
+	float inverse_area;
+	BoxCorners box[8];
+
+	// All images share the layout of the first
+	const FastHessian &fh = *batch[0];
+	const int i_step = fh.i_width;
+
+	const __m128 three4 = _mm_set1_ps(3.0f);
+	const __m128 scale4 = _mm_set1_ps(0.81f);
+	const __m128 sign4 = _mm_set1_ps(-0.0f);
+
+	for(int k=0; k<fh.layers; k++) 
+	{
+		// Only the rows of this layer that lie within the range
+		const int first = std::max(begin, fh.layer_first[k]) - fh.layer_first[k];
+		const int last = std::min(end, fh.layer_first[k] + fh.layer_rows[k]) - fh.layer_first[k];
+		if (first >= last)
+			continue;
+
+		step = fh.layer_step[k];
+		border = fh.layer_border[k];
+
+		l = fh.layer_lobe[k]; 
+		w = 3 * l;                      
+		b = w / 2;        
+		inverse_area = 1.0f/(w * w);     
+
+		// Dxx
+		box[0].set(-l + 1, -b, 2*l - 1, w, i_step);
+		box[1].set(-l + 1, -l / 2, 2*l - 1, l, i_step);
+		// Dyy
+		box[2].set(-b, -l + 1, w, 2*l - 1, i_step);
+		box[3].set(-l / 2, -l + 1, l, 2*l - 1, i_step);
+		// Dxy
+		box[4].set(-l, 1, l, l, i_step);
+		box[5].set(1, -l, l, l, i_step);
+		box[6].set(-l, -l, l, l, i_step);
+		box[7].set(1, 1, l, l, i_step);
+		for(int j=0; j<8; j++) 
+			box[j].interleave(BATCH_LANES);
+
+		const __m128 inv4 = _mm_set1_ps(inverse_area);
+		int index = fh.layer_offset[k] + first * fh.layer_cols[k];
+
+		for(int r = border + first * step; r < border + last * step; r += step) 
+		{
+			for(int c = border; c < fh.i_width - border; c += step, index++) 
+			{
+				const float *p = data + (r*i_step + c) * BATCH_LANES;
+
+				__m128 Dxx = _mm_sub_ps(box[0].sumLanes(p), _mm_mul_ps(box[1].sumLanes(p), three4));
+				__m128 Dyy = _mm_sub_ps(box[2].sumLanes(p), _mm_mul_ps(box[3].sumLanes(p), three4));
+				__m128 Dxy = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(box[4].sumLanes(p), box[5].sumLanes(p)), 
+					box[6].sumLanes(p)), box[7].sumLanes(p));
+
+				// Normalise the filter responses with respect to their size
+				Dxx = _mm_mul_ps(Dxx, inv4);
+				Dyy = _mm_mul_ps(Dyy, inv4);
+				Dxy = _mm_mul_ps(Dxy, inv4);
+
+				// Get the determinant of hessian response, and flip its sign
+				// where the sign of the laplacian is negative
+				__m128 determinant = _mm_sub_ps(_mm_mul_ps(Dxx, Dyy), _mm_mul_ps(_mm_mul_ps(scale4, Dxy), Dxy));
+				__m128 negative = _mm_cmplt_ps(_mm_add_ps(Dxx, Dyy), _mm_setzero_ps());
+				__m128 response = _mm_xor_ps(determinant, _mm_and_ps(negative, sign4));
+				response = _mm_and_ps(response, _mm_cmpge_ps(determinant, _mm_setzero_ps()));
+
+				// Hand each lane to its own image
+				float res[BATCH_LANES];
+				_mm_storeu_ps(res, response);
+				for(int n=0; n<count; n++) 
+					batch[n]->m_det[index] = storeDet(res[n]);
+			}
+		}
+	}
+}
+#endif
+
+//-------------------------------------------------------
+
 //! Non Maximal Suppression function
 int FastHessian::isExtremum(int octave, int interval, int c, int r)
 {
-	int step = init_sample * fRound(pow(2.0f,octave));
+	int step = octave_step[octave];
 
 	// Bounds check
 	if (interval - 1 < 0 || interval + 1 > intervals - 1 
@@ -238,9 +908,27 @@ int FastHessian::isExtremum(int octave, int interval, int c, int r)
 //-------------------------------------------------------
 
 //! Return the value of the approximated determinant of hessian
+//! Note: layers may be shared with finer octaves, which also fill in the
+//! responses outside the border of this octave, so those are masked out
 inline float FastHessian::getVal(int o, int i, int c, int r)
 {
-	return fabs(m_det[(o*intervals+i)*(i_width*i_height) + (r*i_width+c)]);
+	const int border = border_cache[o];
+	if (r < border || r >= i_height - border || c < border || c >= i_width - border)
+		return 0;
+
+	return fabs(loadDet(m_det[getIndex(o, i, c, r)]));
+}
+
+//-------------------------------------------------------
+
+//! Return the position of a sampled response in m_det
+inline int FastHessian::getIndex(int o, int i, int c, int r)
+{
+	const int k = layer_map[o*intervals+i];
+	const int step = layer_step[k];
+	const int border = layer_border[k];
+
+	return layer_offset[k] + ((r - border) / step) * layer_cols[k] + (c - border) / step;
 }
 
 //-------------------------------------------------------
@@ -248,7 +936,7 @@ inline float FastHessian::getVal(int o, int i, int c, int r)
 //! Return the sign of the laplacian (trace of the hessian)
 inline int FastHessian::getLaplacian(int o, int i, int c, int r)
 {
-	float res = (m_det[(o*intervals+i)*(i_width*i_height) + (r*i_width+c)]);
+	float res = loadDet(m_det[getIndex(o, i, c, r)]);
 
 	return (res >= 0 ? 1 : -1);
 }
@@ -257,10 +945,10 @@ inline int FastHessian::getLaplacian(int o, int i, int c, int r)
 
 //! Interpolates a scale-space extremum's location and scale to subpixel
 //! accuracy to form an image feature.   
-void FastHessian::interpolateExtremum(int octv, int intvl, int r, int c)
+void FastHessian::interpolateExtremum(int octv, int intvl, int r, int c, std::vector<OpenSurfInterestPoint> &points)
 {
 	double xi = 0, xr = 0, xc = 0;
-	int step = init_sample * fRound(pow(2.0f,octv));
+	int step = octave_step[octv];
 
 	// Get the offsets to the actual location of the extremum
 	interpolateStep( octv, intvl, r, c, &xi, &xr, &xc );
@@ -272,30 +960,61 @@ void FastHessian::interpolateExtremum(int octv, int intvl, int r, int c)
 		OpenSurfInterestPoint ipt;
 		ipt.x = static_cast<float>(c + step*xc);
 		ipt.y = static_cast<float>(r + step*xr);
-		ipt.scale = static_cast<float>((1.2f/9.0f) * (3*(pow(2.0f, octv+1) * (intvl+xi+1)+1)));
+		ipt.scale = static_cast<float>((1.2f/9.0f) * (3*((2 << octv) * (intvl+xi+1)+1)));
 		ipt.laplacian = getLaplacian(octv, intvl, c, r);
-		ipts.push_back(ipt);
+		ipt.response = getVal(octv, intvl, c, r);
+		points.push_back(ipt);
 	}
 }
 
 //-------------------------------------------------------
 
-//! Performs one step of extremum interpolation. 
+//! Performs one step of extremum interpolation, i.e. solves H * x = -dD
 void FastHessian::interpolateStep( int octv, int intvl, int r, int c, double* xi, double* xr, double* xc )
 {
-	CvMat* dD, * H, * H_inv, X;
+	double dD[3], H[3][3], H_inv[3][3];
 	double x[3] = { 0 };
 
-	dD = deriv3D( octv, intvl, r, c );
-	H = hessian3D( octv, intvl, r, c );
-	H_inv = cvCreateMat( 3, 3, CV_64FC1 );
-	cvInvert( H, H_inv, CV_SVD );
-	cvInitMatHeader( &X, 3, 1, CV_64FC1, x, CV_AUTOSTEP );
-	cvGEMM( H_inv, dD, -1, NULL, 0, &X, 0 );
+	deriv3D( octv, intvl, r, c, dD );
+	hessian3D( octv, intvl, r, c, H );
+
+	// Invert the hessian through its adjugate, which only requires the 
+	// cofactors and the determinant
+	H_inv[0][0] = H[1][1]*H[2][2] - H[1][2]*H[2][1];
+	H_inv[0][1] = H[0][2]*H[2][1] - H[0][1]*H[2][2];
+	H_inv[0][2] = H[0][1]*H[1][2] - H[0][2]*H[1][1];
+	H_inv[1][0] = H[1][2]*H[2][0] - H[1][0]*H[2][2];
+	H_inv[1][1] = H[0][0]*H[2][2] - H[0][2]*H[2][0];
+	H_inv[1][2] = H[0][2]*H[1][0] - H[0][0]*H[1][2];
+	H_inv[2][0] = H[1][0]*H[2][1] - H[1][1]*H[2][0];
+	H_inv[2][1] = H[0][1]*H[2][0] - H[0][0]*H[2][1];
+	H_inv[2][2] = H[0][0]*H[1][1] - H[0][1]*H[1][0];
+	double det = H[0][0]*H_inv[0][0] + H[0][1]*H_inv[1][0] + H[0][2]*H_inv[2][0];
+
+	// The determinant is compared to the scale of the hessian, as the
+	// adjugate loses all precision when the hessian is (nearly) singular
+	double norm = 0;
+	for( int i = 0; i < 3; i++ )
+		for( int j = 0; j < 3; j++ )
+			norm = std::max( norm, fabs( H[i][j] ) );
+
+	if( fabs( det ) > 1e-10 * norm * norm * norm )
+	{
+		for( int i = 0; i < 3; i++ )
+			for( int j = 0; j < 3; j++ )
+				H_inv[i][j] /= det;
+	}
+	else
+	{
+		// Fall back to the pseudo inverse for singular cases
+		CvMat Hm, H_invm;
+		cvInitMatHeader( &Hm, 3, 3, CV_64FC1, H, CV_AUTOSTEP );
+		cvInitMatHeader( &H_invm, 3, 3, CV_64FC1, H_inv, CV_AUTOSTEP );
+		cvInvert( &Hm, &H_invm, CV_SVD );
+	}
 
-	cvReleaseMat( &dD );
-	cvReleaseMat( &H );
-	cvReleaseMat( &H_inv );
+	for( int i = 0; i < 3; i++ )
+		x[i] = -( H_inv[i][0]*dD[0] + H_inv[i][1]*dD[1] + H_inv[i][2]*dD[2] );
 
 	*xi = x[2];
 	*xr = x[1];
@@ -305,11 +1024,10 @@ void FastHessian::interpolateStep( int octv, int intvl, int r, int c, double* xi
 //-------------------------------------------------------
 
 //! Computes the partial derivatives in x, y, and scale of a pixel.
-CvMat* FastHessian::deriv3D( int octv, int intvl, int r, int c )
+void FastHessian::deriv3D( int octv, int intvl, int r, int c, double dI[3] )
 {
-	CvMat* dI;
 	double dx, dy, ds;
-	int step = init_sample * fRound(pow(2.0f,octv));
+	int step = octave_step[octv];
 
 	dx = ( getVal(octv,intvl, c+step, r ) -
 		getVal( octv,intvl, c-step, r ) ) / 2.0;
@@ -318,22 +1036,18 @@ CvMat* FastHessian::deriv3D( int octv, int intvl, int r, int c )
 	ds = ( getVal( octv,intvl+1, c, r ) -
 		getVal( octv,intvl-1, c, r ) ) / 2.0;
 
-	dI = cvCreateMat( 3, 1, CV_64FC1 );
-	cvmSet( dI, 0, 0, dx );
-	cvmSet( dI, 1, 0, dy );
-	cvmSet( dI, 2, 0, ds );
-
-	return dI;
+	dI[0] = dx;
+	dI[1] = dy;
+	dI[2] = ds;
 }
 
 //-------------------------------------------------------
 
 //! Computes the 3D Hessian matrix for a pixel.
-CvMat* FastHessian::hessian3D(int octv, int intvl, int r, int c )
+void FastHessian::hessian3D(int octv, int intvl, int r, int c, double H[3][3] )
 {
-	CvMat* H;
 	double v, dxx, dyy, dss, dxy, dxs, dys;
-	int step = init_sample * fRound(pow(2.0f,octv));
+	int step = octave_step[octv];
 
 	v = getVal( octv,intvl, c, r );
 	dxx = ( getVal( octv,intvl, c+step, r ) + 
@@ -355,18 +1069,15 @@ CvMat* FastHessian::hessian3D(int octv, int intvl, int r, int c )
 		getVal( octv,intvl-1, c, r+step ) +
 		getVal( octv,intvl-1, c, r-step ) ) / 4.0;
 
-	H = cvCreateMat( 3, 3, CV_64FC1 );
-	cvmSet( H, 0, 0, dxx );
-	cvmSet( H, 0, 1, dxy );
-	cvmSet( H, 0, 2, dxs );
-	cvmSet( H, 1, 0, dxy );
-	cvmSet( H, 1, 1, dyy );
-	cvmSet( H, 1, 2, dys );
-	cvmSet( H, 2, 0, dxs );
-	cvmSet( H, 2, 1, dys );
-	cvmSet( H, 2, 2, dss );
-
-	return H;
+	H[0][0] = dxx;
+	H[0][1] = dxy;
+	H[0][2] = dxs;
+	H[1][0] = dxy;
+	H[1][1] = dyy;
+	H[1][2] = dys;
+	H[2][0] = dxs;
+	H[2][1] = dys;
+	H[2][2] = dss;
 }
 
 //-------------------------------------------------------
\ No newline at end of file
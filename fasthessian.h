@@ -18,11 +18,22 @@
 #include <vector>
 using namespace std;
 
+class ThreadPool;
+
 static const int OCTAVES = 4;
 static const int INTERVALS = 4;
 static const float THRES = 0.0004f;
 static const int INIT_SAMPLE = 2;
 
+//! Store the determinant of hessian responses in half precision, which halves
+//! the memory they take at the cost of some precision of the responses
+//#define OPENSURF_HALF_DET
+#ifdef OPENSURF_HALF_DET
+typedef unsigned short DetValue;
+#else
+typedef float DetValue;
+#endif
+
 
 class FastHessian {
 
@@ -46,7 +57,7 @@ public:
 		const int init_sample = INIT_SAMPLE, 
 		const float thres = THRES);
 
-	//! Save the parameters
+	//! Save the parameters, and work out which filters can be shared between octaves
 	void saveParameters(const int octaves, 
 		const int intervals,
 		const int init_sample, 
@@ -55,15 +66,61 @@ public:
 	//! Set or re-set the integral image source
 	void setIntImage(IplImage *img);
 
-	//! Find the image features and write into vector of features
-	void getIpoints();
+	//! Find the image features and write into vector of features, split
+	//! across the threads of the pool if one is given. With a deadline (see
+	//! GetMonotonicTime) the octaves are searched from coarse to fine, and the
+	//! search stops after the octave during which the deadline passed or after
+	//! which at least the given number of features were found, or before an
+	//! octave that is predicted not to finish in time. It always goes on
+	//! until an octave with any features was searched. Returns the number
+	//! of features found up to and including that octave, which come first in
+	//! the vector, or all features without a deadline
+	int getIpoints(ThreadPool *pool = NULL, double deadline = 0, int enough = 0);
+
+	//! Number of images whose responses are calculated together when the
+	//! features of a batch of images are found, one image per SIMD lane
+	static const int BATCH_LANES = 4;
+
+	//! Find the image features of a batch of images, each with a detector of
+	//! its own. The integral images of every BATCH_LANES images are interleaved
+	//! pixel by pixel, so a single load fetches a box corner of all of them and
+	//! their responses are calculated together without any divergence between
+	//! the lanes, after which each image is searched on its own. Images whose
+	//! detectors differ in parameters or image size are done one by one. The
+	//! interleaved images are kept in the given buffer, which the caller can
+	//! keep between batches so it does not have to be allocated every time
+	static void getBatchIpoints(FastHessian **batch, int count, std::vector<float> &data, ThreadPool *pool = NULL);
+
+	//! Calculates the responses of the rows from first up to but not including
+	//! last of a single layer, specialized for its filter, step and image size
+	typedef void (*LayerKernel)(const float *data, DetValue *det, int first, int last);
 
 private:
 
+	friend class FastHessianTask;
+	friend class FastHessianBatchTask;
+
 	//---------------- Private Functions -----------------//
 
-	//! Calculate determinant of hessian responses
-	void buildDet();
+	//! Calculate determinant of hessian responses of a range of rows
+	void buildDet(ThreadPool *pool, int begin, int end);
+
+	//! Calculate the responses of the rows from begin up to but not including 
+	//! end, counting the rows of all layers one after the other
+	void buildDetRows(int begin, int end);
+
+	//! Calculate the responses of a range of rows of a batch of images with
+	//! the same layout, from their interleaved integral images
+	static void buildBatchRows(FastHessian **batch, int count, const float *data, int begin, int end);
+
+	//! Check whether the responses are laid out the same as those of another
+	bool sameLayout(const FastHessian &other) const;
+
+	//! Find the image features in a range of rows of non-max suppression blocks
+	void suppress(ThreadPool *pool, int begin, int end);
+
+	//! Find the image features in a row of non-max suppression blocks
+	void suppressRow(int row, std::vector<OpenSurfInterestPoint> &points);
 
 	//! Non Maximal Suppression function
 	int isExtremum(int octave, int interval, int column, int row);    
@@ -71,14 +128,17 @@ private:
 	//! Return the value of the approximated determinant of hessian
 	inline float getVal(int octave, int interval, int column, int row);
 
+	//! Return the position of a sampled response in the determinant of hessian pyramid
+	inline int getIndex(int octave, int interval, int column, int row);
+
 	//! Return the sign of the laplacian (trace of the hessian)
 	inline int getLaplacian(int o, int i, int c, int r);
 
 	//! Interpolation functions - adapted from Lowe's SIFT implementation
-	void interpolateExtremum(int octv, int intvl, int r, int c);
+	void interpolateExtremum(int octv, int intvl, int r, int c, std::vector<OpenSurfInterestPoint> &points);
 	void interpolateStep( int octv, int intvl, int r, int c, double* xi, double* xr, double* xc );
-	CvMat* deriv3D( int octv, int intvl, int r, int c );
-	CvMat* hessian3D(int octv, int intvl, int r, int c );
+	void deriv3D( int octv, int intvl, int r, int c, double dI[3] );
+	void hessian3D(int octv, int intvl, int r, int c, double H[3][3] );
 
 	//---------------- Private Variables -----------------//
 
@@ -101,8 +161,50 @@ private:
 	//! Threshold value for blob resonses
 	float thres;
 
-	//! Array stack of determinant of hessian values
-	float *m_det;
+	//! Sampling step of each octave
+	int octave_step[OCTAVES];
+
+	//! Number of determinant of hessian layers, i.e. unique filters
+	int layers;
+
+	//! Filter lobe, sampling step and border of each layer
+	int layer_lobe[OCTAVES*INTERVALS];
+	int layer_step[OCTAVES*INTERVALS];
+	int layer_border[OCTAVES*INTERVALS];
+
+	//! Position of each layer in m_det, and its number of sampled columns and rows
+	int layer_offset[OCTAVES*INTERVALS];
+	int layer_cols[OCTAVES*INTERVALS];
+	int layer_rows[OCTAVES*INTERVALS];
+
+	//! Kernel specialized for each layer at the current image size, if any
+	LayerKernel layer_kernel[OCTAVES*INTERVALS];
+
+	//! Layer that each interval of each octave reads its responses from
+	int layer_map[OCTAVES*INTERVALS];
+
+	//! Number of rows of all layers before each layer, and of all layers
+	int layer_first[OCTAVES*INTERVALS];
+	int det_rows;
+
+	//! Octave, interval and first image row of a row of non-max suppression blocks
+	struct SuppressionRow
+	{
+		int octave, interval, row;
+	};
+
+	//! Rows of non-max suppression blocks, in the order they are searched
+	std::vector<SuppressionRow> suppression_rows;
+
+	//! First row of non-max suppression blocks of each octave, and the end
+	int octave_first[OCTAVES+1];
+
+	//! Image features found in each row of blocks when searched by several threads
+	std::vector< std::vector<OpenSurfInterestPoint> > suppression_ipts;
+
+	//! Array stack of determinant of hessian values, one per layer, which only
+	//! holds the responses at the sampled positions inside the border of the layer
+	DetValue *m_det;
 
 };
 
@@ -51,7 +51,7 @@ KDTree::KDTree(Dataset<float>& inputData, Params params) : dataset(inputData)
 	numTrees = (int)params["trees"];
 
 	trees = new Tree[numTrees];
-	heap = new Heap<BranchSt>(size_);
+	context = NULL;
 	checkID = -1000;
 
 	// Create a permutable array of indices to the input vectors.
@@ -72,7 +72,7 @@ KDTree::KDTree(Dataset<float>& inputData, const FLANNParameters &params) : datas
 	// get the parameters
 	numTrees = params.trees;
 	trees = new Tree[numTrees];
-	heap = new Heap<BranchSt>(size_);
+	context = NULL;
 	checkID = -1000;
 	// Create a permutable array of indices to the input vectors.
 	vind = new int[size_];
@@ -90,12 +90,40 @@ KDTree::~KDTree()
 {
 	delete[] vind;
     delete[] trees;
-	delete heap;
+	delete context;
     delete[] mean;
     delete[] var;
 }
 
 
+/**
+ * Creates a context for searching the given tree.
+ */
+KDTree::SearchContext::SearchContext(const KDTree& tree)
+{
+	checked = new int[tree.size_];
+	memset(checked, 0, tree.size_*sizeof(int));
+	checkID = -1000;
+	heap = new Heap<BranchSt>(tree.size_);
+}
+
+KDTree::SearchContext::~SearchContext()
+{
+	delete[] checked;
+	delete heap;
+}
+
+/**
+ * Returns the context used by the searches that don't provide their own.
+ */
+KDTree::SearchContext& KDTree::defaultContext()
+{
+	if (context == NULL) {
+		context = new SearchContext(*this);
+	}
+	return *context;
+}
+
 /**
  * Builds the index
  */
@@ -282,22 +310,33 @@ void KDTree::findNeighbors(ResultSet& result, float* vec, Params searchParams)
         maxChecks = (int)searchParams["checks"];
     }
 
+    findNeighbors(result, vec, maxChecks);
+}
+
+void KDTree::findNeighbors(ResultSet& result, float* vec, int maxChecks)
+{
+    findNeighbors(result, vec, maxChecks, defaultContext());
+}
+
+void KDTree::findNeighbors(ResultSet& result, float* vec, int maxChecks, SearchContext& searchContext) const
+{
     if (maxChecks<0) {
-        getExactNeighbors(result, vec);
+        getExactNeighbors(result, vec, searchContext);
     } else {
-        getNeighbors(result, vec, maxChecks);
+        getNeighbors(result, vec, maxChecks, searchContext);
     }
 }
 
 void KDTree::continueSearch(ResultSet& result, float* vec, int maxCheck)
 {
 	BranchSt branch;
+	SearchContext& searchContext = defaultContext();
 
 	int checkCount = 0;
 
 	/* Keep searching other branches from heap until finished. */
-	while ( heap->popMin(branch) && (checkCount < maxCheck || !result.full() )) {
-		searchLevel(result, vec, branch.node,branch.mindistsq, checkCount, maxCheck);
+	while ( searchContext.heap->popMin(branch) && (checkCount < maxCheck || !result.full() )) {
+		searchLevel(result, vec, branch.node,branch.mindistsq, checkCount, maxCheck, searchContext);
 	}
 
 	assert(result.full());
@@ -453,15 +492,15 @@ void KDTree::subdivide(Tree node, int first, int last)
  * Performs an exact nearest neighbor search. The exact search performs a full
  * traversal of the tree.
  */
-void KDTree::getExactNeighbors(ResultSet& result, float* vec)
+void KDTree::getExactNeighbors(ResultSet& result, float* vec, SearchContext& searchContext) const
 {
-	checkID -= 1;  /* Set a different unique ID for each search. */
+	searchContext.checkID -= 1;  /* Set a different unique ID for each search. */
 
 	if (numTrees > 1) {
         fprintf(stderr,"It doesn't make any sense to use more than one tree for exact search");
 	}
 	if (numTrees>0) {
-		searchLevelExact(result, vec, trees[0], 0.0);
+		searchLevelExact(result, vec, trees[0], 0.0, searchContext);
 	}
 	assert(result.full());
 }
@@ -471,23 +510,23 @@ void KDTree::getExactNeighbors(ResultSet& result, float* vec)
  * because the tree traversal is abandoned after a given number of descends in
  * the tree.
  */
-void KDTree::getNeighbors(ResultSet& result, float* vec, int maxCheck)
+void KDTree::getNeighbors(ResultSet& result, float* vec, int maxCheck, SearchContext& searchContext) const
 {
 	int i;
 	BranchSt branch;
 
 	int checkCount = 0;
-	heap->clear();
-	checkID -= 1;  /* Set a different unique ID for each search. */
+	searchContext.heap->clear();
+	searchContext.checkID -= 1;  /* Set a different unique ID for each search. */
 
 	/* Search once through each tree down to root. */
 	for (i = 0; i < numTrees; ++i) {
-		searchLevel(result, vec, trees[i], 0.0, checkCount, maxCheck);
+		searchLevel(result, vec, trees[i], 0.0, checkCount, maxCheck, searchContext);
 	}
 
 	/* Keep searching other branches from heap until finished. */
-	while ( heap->popMin(branch) && (checkCount < maxCheck || !result.full() )) {
-		searchLevel(result, vec, branch.node,branch.mindistsq, checkCount, maxCheck);
+	while ( searchContext.heap->popMin(branch) && (checkCount < maxCheck || !result.full() )) {
+		searchLevel(result, vec, branch.node,branch.mindistsq, checkCount, maxCheck, searchContext);
 	}
 
 	assert(result.full());
@@ -498,7 +537,7 @@ void KDTree::getNeighbors(ResultSet& result, float* vec, int maxCheck)
  *  higher levels, all exemplars below this level must have a distance of
  *  at least "mindistsq".
 */
-void KDTree::searchLevel(ResultSet& result, float* vec, Tree node, float mindistsq, int& checkCount, int maxCheck)
+void KDTree::searchLevel(ResultSet& result, float* vec, Tree node, float mindistsq, int& checkCount, int maxCheck, SearchContext& searchContext) const
 {
 	if (result.worstDist()<mindistsq) {
 //			printf("Ignoring branch, too far\n");
@@ -512,14 +551,14 @@ void KDTree::searchLevel(ResultSet& result, float* vec, Tree node, float mindist
 	if (node->child1 == NULL  &&  node->child2 == NULL) {
 
 		/* Do not check same node more than once when searching multiple trees.
-			Once a vector is checked, we set its location in vind to the
-			current checkID.
+			Once a vector is checked, we set its location in the checked array
+			of the context to the current checkID.
 		*/
-		if (vind[node->divfeat] == checkID || checkCount>=maxCheck) {
+		if (searchContext.checked[node->divfeat] == searchContext.checkID || checkCount>=maxCheck) {
 			if (result.full()) return;
 		}
         checkCount++;
-		vind[node->divfeat] = checkID;
+		searchContext.checked[node->divfeat] = searchContext.checkID;
 
 		result.addPoint(dataset[node->divfeat],node->divfeat);
 		return;
@@ -542,17 +581,17 @@ void KDTree::searchLevel(ResultSet& result, float* vec, Tree node, float mindist
 	double new_distsq = flann_dist(&val, &val+1, &node->divval, mindistsq);
 //		if (2 * checkCount < maxCheck  ||  !result.full()) {
 	if (new_distsq < result.worstDist() ||  !result.full()) {
-		heap->insert( BranchSt::make_branch(otherChild, new_distsq) );
+		searchContext.heap->insert( BranchSt::make_branch(otherChild, new_distsq) );
 	}
 
 	/* Call recursively to search next level down. */
-	searchLevel(result, vec, bestChild, mindistsq, checkCount, maxCheck);
+	searchLevel(result, vec, bestChild, mindistsq, checkCount, maxCheck, searchContext);
 }
 
 /**
  * Performs an exact search in the tree starting from a node.
  */
-void KDTree::searchLevelExact(ResultSet& result, float* vec, Tree node, float mindistsq)
+void KDTree::searchLevelExact(ResultSet& result, float* vec, Tree node, float mindistsq, SearchContext& searchContext) const
 {
 	if (mindistsq>result.worstDist()) {
 		return;
@@ -565,12 +604,12 @@ void KDTree::searchLevelExact(ResultSet& result, float* vec, Tree node, float mi
 	if (node->child1 == NULL  &&  node->child2 == NULL) {
 
 		/* Do not check same node more than once when searching multiple trees.
-			Once a vector is checked, we set its location in vind to the
-			current checkID.
+			Once a vector is checked, we set its location in the checked array
+			of the context to the current checkID.
 		*/
-		if (vind[node->divfeat] == checkID)
+		if (searchContext.checked[node->divfeat] == searchContext.checkID)
 			return;
-		vind[node->divfeat] = checkID;
+		searchContext.checked[node->divfeat] = searchContext.checkID;
 
 		result.addPoint(dataset[node->divfeat],node->divfeat);
 		return;
@@ -584,7 +623,7 @@ void KDTree::searchLevelExact(ResultSet& result, float* vec, Tree node, float mi
 
 
 	/* Call recursively to search next level down. */
-	searchLevelExact(result, vec, bestChild, mindistsq);
+	searchLevelExact(result, vec, bestChild, mindistsq, searchContext);
 	double new_distsq = flann_dist(&val, &val+1, &node->divval, mindistsq);
-	searchLevelExact(result, vec, otherChild, new_distsq);
+	searchLevelExact(result, vec, otherChild, new_distsq, searchContext);
 }
@@ -74,12 +74,12 @@ class KDTree : public NNIndex
 	 */
 	int numTrees;
 	/**
-	 *  Array of indices to vectors in the dataset.  When doing lookup,
-	 *  this is used instead to mark checkID.
+	 *  Array of indices to vectors in the dataset.
 	 */
 	int* vind;
 	/**
-	 * An unique ID for each lookup.
+	 * An unique ID for each lookup. Only kept for compatibility with saved
+	 * indices, the search contexts keep track of their own IDs.
 	 */
 	int checkID;
 	/**
@@ -120,10 +120,6 @@ class KDTree : public NNIndex
     Tree* trees;
     typedef BranchStruct<Tree> BranchSt;
     typedef BranchSt* Branch;
-    /**
-     * Priority queue storing intermediate branches in the best-bin-first search
-     */
-    Heap<BranchSt>* heap;
 	/**
 	 * Pooled memory allocator.
 	 *
@@ -133,6 +129,49 @@ class KDTree : public NNIndex
 	 */
 	PooledAllocator pool;
 
+public:
+	/**
+	 * The state that is modified while searching the tree: the vectors that
+	 * have already been checked and the priority queue storing intermediate
+	 * branches in the best-bin-first search.
+	 *
+	 * Keeping this state outside of the tree allows several threads to
+	 * search the same tree at once, each using its own context. The tree
+	 * itself is then only read. Note that flann_set_distance_type must not
+	 * be called while any searches are in progress.
+	 */
+	class SearchContext {
+		friend class KDTree;
+		/**
+		 * The search ID that last checked each of the vectors in the dataset.
+		 */
+		int* checked;
+		/**
+		 * An unique ID for each lookup.
+		 */
+		int checkID;
+		/**
+		 * Priority queue storing intermediate branches in the best-bin-first search
+		 */
+		Heap<BranchSt>* heap;
+		// not copyable
+		SearchContext(const SearchContext&);
+		SearchContext& operator=(const SearchContext&);
+	public:
+		/**
+		 * Creates a context for searching the given tree.
+		 */
+		SearchContext(const KDTree& tree);
+		~SearchContext();
+	};
+
+private:
+	/**
+	 * Context used by the searches that don't provide their own, which is
+	 * created on first use.
+	 */
+	SearchContext* context;
+
 public:
     flann_algorithm_t getType() const;
 
@@ -181,6 +220,30 @@ public:
      *     maxCheck = the maximum number of restarts (in a best-bin-first manner)
      */
     void findNeighbors(ResultSet& result, float* vec, Params searchParams);
+    /**
+     * Same as above, but with the number of checks already extracted from the
+     * search parameters. This avoids building and copying a Params map for
+     * every query when searching many vectors in a row.
+     *
+     * Params:
+     *     result = the result object in which the indices of the nearest-neighbors are stored
+     *     vec = the vector for which to search the nearest neighbors
+     *     maxChecks = the maximum number of leaves to check, or a negative value for an exact search
+     */
+    void findNeighbors(ResultSet& result, float* vec, int maxChecks);
+    /**
+     * Same as above, but keeps all search state in the provided context
+     * instead of in the tree, so the tree can be searched from multiple
+     * threads at once as long as each thread uses its own context and
+     * result set.
+     *
+     * Params:
+     *     result = the result object in which the indices of the nearest-neighbors are stored
+     *     vec = the vector for which to search the nearest neighbors
+     *     maxChecks = the maximum number of leaves to check, or a negative value for an exact search
+     *     searchContext = the context to use for this search
+     */
+    void findNeighbors(ResultSet& result, float* vec, int maxChecks, SearchContext& searchContext) const;
 	void continueSearch(ResultSet& result, float* vec, int maxCheck);
     Params estimateSearchParams(float precision, Dataset<float>* testset = NULL);
 private:
@@ -214,23 +277,27 @@ private:
 	 * Performs an exact nearest neighbor search. The exact search performs a full
 	 * traversal of the tree.
 	 */
-	void getExactNeighbors(ResultSet& result, float* vec);
+	void getExactNeighbors(ResultSet& result, float* vec, SearchContext& searchContext) const;
 	/**
 	 * Performs the approximate nearest-neighbor search. The search is approximate
 	 * because the tree traversal is abandoned after a given number of descends in
 	 * the tree.
 	 */
-	void getNeighbors(ResultSet& result, float* vec, int maxCheck);
+	void getNeighbors(ResultSet& result, float* vec, int maxCheck, SearchContext& searchContext) const;
 	/**
 	 *  Search starting from a given node of the tree.  Based on any mismatches at
 	 *  higher levels, all exemplars below this level must have a distance of
 	 *  at least "mindistsq".
 	*/
-	void searchLevel(ResultSet& result, float* vec, Tree node, float mindistsq, int& checkCount, int maxCheck);
+	void searchLevel(ResultSet& result, float* vec, Tree node, float mindistsq, int& checkCount, int maxCheck, SearchContext& searchContext) const;
 	/**
 	 * Performs an exact search in the tree starting from a node.
 	 */
-	void searchLevelExact(ResultSet& result, float* vec, Tree node, float mindistsq);
+	void searchLevelExact(ResultSet& result, float* vec, Tree node, float mindistsq, SearchContext& searchContext) const;
+	/**
+	 * Returns the context used by the searches that don't provide their own.
+	 */
+	SearchContext& defaultContext();
 };   // class KDTree
 
 register_index(KDTREE,KDTree)
@@ -10,68 +10,264 @@
 
 #include "integral.h"
 
-// Convert image to single channel 32F
-IplImage *getGray(const IplImage *img)
+#include <vector>
+
+//-------------------------------------------------------
+// weights of the gray conversion, identical to the fixed point weights that
+// cvCvtColor uses for CV_BGR2GRAY so both produce exactly the same gray values
+static const int gray_shift = 14;
+static const int gray_r = 4899;
+static const int gray_g = 9617;
+static const int gray_b = (1 << gray_shift) - gray_r - gray_g;
+
+//! Fills the table that maps 8-bit gray values to floats between 0 and 1, in
+//! the same way as cvConvertScale does for the scale 1/255
+static void getGrayTable(float *table)
+{
+	double val = 0, scale = 1.0 / 255.0;
+	for (int i = 0; i < 256; i++, val += scale)
+		table[i] = (float) val;
+}
+
+//! Adds the above row to the row, i.e. row[j] += above[j]
+static void addRow(float *row, const float *above, int width)
+{
+	int j = 0;
+#ifdef OPENSURF_SSE2
+	for (; j + 4 <= width; j += 4)
+		_mm_storeu_ps(row + j, _mm_add_ps(_mm_loadu_ps(row + j), _mm_loadu_ps(above + j)));
+#endif
+	for (; j < width; j++)
+		row[j] += above[j];
+}
+
+//! Adds the weighted source row to the row, i.e. row[j] += weight * src[j]
+static void accumulateRow(float *row, const float *src, float weight, int width)
+{
+	int j = 0;
+#ifdef OPENSURF_SSE2
+	__m128 w4 = _mm_set1_ps(weight);
+	for (; j + 4 <= width; j += 4)
+		_mm_storeu_ps(row + j, _mm_add_ps(_mm_loadu_ps(row + j), _mm_mul_ps(_mm_loadu_ps(src + j), w4)));
+#endif
+	for (; j < width; j++)
+		row[j] += weight * src[j];
+}
+
+//! Turns a row of gray values into a row of the integral image, given the
+//! integral image row above it (or NULL for the first row)
+static void integrateRow(float *row, const float *above, int width)
+{
+	float rs = 0.0f;
+	for (int j = 0; j < width; j++)
+	{
+		rs += row[j];
+		row[j] = rs;
+	}
+	if (above)
+		addRow(row, above, width);
+}
+
+//-------------------------------------------------------
+
+//! Computes the integral image of image img.  Assumes source image to be a 
+//! 8-bit gray, BGR or BGRA image.  Returns IplImage of 32-bit float form.
+IplImage *Integral(IplImage *source)
 {
 	// Check we have been supplied a non-null img pointer
-	if (!img)
+	if (!source)
 		return NULL;
 
-	IplImage* gray8, * gray32;
+	IplImage *int_img = cvCreateImage(cvGetSize(source), IPL_DEPTH_32F, 1);
+	Integral((const unsigned char *) source->imageData, source->width, source->height, 
+		source->widthStep, source->nChannels, int_img);
 
-	gray32 = cvCreateImage( cvGetSize(img), IPL_DEPTH_32F, 1 );
+	// return the integral image
+	return int_img;
+}
 
-	if( img->nChannels == 1 )
-		gray8 = (IplImage *) cvClone( img );
-	else {
-		gray8 = cvCreateImage( cvGetSize(img), IPL_DEPTH_8U, 1 );
-		cvCvtColor( img, gray8, CV_BGR2GRAY );
-	}
+//-------------------------------------------------------
 
-	cvConvertScale( gray8, gray32, 1.0 / 255.0, 0 );
+//! Computes the integral image of 8-bit pixels of the same size as int_img, 
+//! converting them to gray in the same pass.
+void Integral(const unsigned char *data, int width, int height, int step, int channels, IplImage *int_img, bool rgb)
+{
+	float gray[256];
+	getGrayTable(gray);
+
+	// positions of the blue and red values within a color pixel
+	const int b = rgb ? 2 : 0, r = rgb ? 0 : 2;
+
+	int i_step = int_img->widthStep/sizeof(float);
+	float *i_data = (float *) int_img->imageData;
 
-	cvReleaseImage( &gray8 );
-	return gray32;
+	for(int i=0; i<height; ++i, data += step, i_data += i_step) 
+	{
+		// convert the row to gray
+		const unsigned char *p = data;
+		if (channels == 1)
+		{
+			for(int j=0; j<width; j++, p++) 
+				i_data[j] = gray[p[0]];
+		}
+		else
+		{
+			for(int j=0; j<width; j++, p += channels) 
+				i_data[j] = gray[(p[b]*gray_b + p[1]*gray_g + p[r]*gray_r + (1 << (gray_shift-1))) >> gray_shift];
+		}
+
+		// cells are the sum of the row so far plus the cell above
+		integrateRow(i_data, i ? i_data - i_step : NULL, width);
+	}
 }
 
-//! Computes the integral image of image img.  Assumes source image to be a 
-//! 32-bit floating point.  Returns IplImage of 32-bit float form.
-IplImage *Integral(IplImage *source)
+//-------------------------------------------------------
+
+static void getAreaTable(int src, int dst, AreaTable &table)
 {
-	// convert the image to single channel 32f
-	IplImage *img = getGray(source);
-	IplImage *int_img = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
-
-	// set up variables for data access
-	int height = img->height;
-	int width = img->width;
-	int step = img->widthStep/sizeof(float);
-	float *data   = (float *) img->imageData;  
-	float *i_data = (float *) int_img->imageData;  
-
-	// first row only
-	float rs = 0.0f;
-	for(int j=0; j<width; j++) 
+	double scale = (double) src / dst;
+	float full = (float) (1.0 / scale);
+	table.start.resize(dst + 1);
+	table.index.clear();
+	table.weight.clear();
+	for (int d = 0; d < dst; d++)
 	{
-		rs += data[j]; 
-		i_data[j] = rs;
+		table.start[d] = (int) table.index.size();
+		double f1 = d * scale, f2 = f1 + scale;
+		int s1 = (int) ceil(f1), s2 = std::min((int) floor(f2), src);
+		// partially covered pixel at the start
+		if (s1 - f1 > 1e-3)
+		{
+			table.index.push_back(s1 - 1);
+			table.weight.push_back((float) ((s1 - f1) / scale));
+		}
+		// fully covered pixels
+		for (int s = s1; s < s2; s++)
+		{
+			table.index.push_back(s);
+			table.weight.push_back(full);
+		}
+		// partially covered pixel at the end
+		if (s2 < src && f2 - s2 > 1e-3)
+		{
+			table.index.push_back(s2);
+			table.weight.push_back((float) (std::min(f2 - s2, 1.0) / scale));
+		}
 	}
+	table.start[dst] = (int) table.index.size();
+}
+
+//! Computes the integral image from 8-bit pixels that are larger than int_img,
+//! shrinking them to the size of int_img by averaging the area that each pixel
+//! of int_img covers, converting them to gray in the same pass.
+void IntegralArea(const unsigned char *data, int width, int height, int step, int channels, IplImage *int_img, 
+				  IntegralAreaStream &stream, bool rgb)
+{
+	stream.start(width, height, channels, int_img, rgb);
+	for(int i=0; i<height; ++i, data += step) 
+		stream.addRow(data);
+}
 
-	// remaining cells are sum above and to the left
-	for(int i=1; i<height; ++i) 
+//-------------------------------------------------------
+
+IntegralAreaStream::IntegralAreaStream()
+	: width(0), channels(0), int_img(NULL), blue(0), red(2), row(0), dst_row(0)
+{
+}
+
+//-------------------------------------------------------
+
+//! Prepares the integral image of a width x height image whose rows are added
+//! one at a time
+void IntegralAreaStream::start(int width, int height, int channels, IplImage *int_img, bool rgb)
+{
+	this->width = width;
+	this->channels = channels;
+	this->int_img = int_img;
+	blue = rgb ? 2 : 0;
+	red = rgb ? 0 : 2;
+	row = 0;
+	dst_row = 0;
+
+	// per channel lookup tables that directly give the gray value between 0 and 1
+	const double norm = 1.0 / (255.0 * (1 << gray_shift));
+	for (int v = 0; v < 256; v++)
 	{
-		rs = 0.0f;
-		for(int j=0; j<width; ++j) 
+		if (channels == 1)
+			lut[0][v] = (float) (v / 255.0);
+		else 
 		{
-			rs += data[i*step+j]; 
-			i_data[i*step+j] = rs + i_data[(i-1)*step+j];
+			lut[0][v] = (float) (v * gray_b * norm);
+			lut[1][v] = (float) (v * gray_g * norm);
+			lut[2][v] = (float) (v * gray_r * norm);
 		}
 	}
 
-	// release the gray image
-	cvReleaseImage(&img);
+	getAreaTable(width, int_img->width, xtab);
+	getAreaTable(height, int_img->height, ytab);
 
-	// return the integral image
-	return int_img;
+	grow.resize(width);
+	vrow[0].assign(width, 0.0f);
+	vrow[1].assign(width, 0.0f);
 }
 
+//-------------------------------------------------------
+
+//! Adds the next row of pixels, and completes the rows of the integral image
+//! that the pixels above it and this row cover
+//! Note: since the image is shrunk, each row covers at most two destination 
+//! rows, whose vertical averages are accumulated in the order of the rows
+void IntegralAreaStream::addRow(const unsigned char *data)
+{
+	const int i_width = int_img->width;
+	const int i_height = int_img->height;
+	const int i_step = int_img->widthStep/sizeof(float);
+
+	// convert the row to gray
+	const unsigned char *p = data;
+	if (channels == 1)
+	{
+		for (int j = 0; j < width; j++, p++)
+			grow[j] = lut[0][p[0]];
+	}
+	else
+	{
+		for (int j = 0; j < width; j++, p += channels)
+			grow[j] = lut[0][p[blue]] + lut[1][p[1]] + lut[2][p[red]];
+	}
+
+	// add it to the destination rows it covers, whose source rows are consecutive
+	for (int i = dst_row; i < std::min(dst_row + 2, i_height); i++)
+	{
+		const int first = ytab.start[i], last = ytab.start[i+1];
+		if (first == last || ytab.index[first] > row)
+			break;
+		const int t = first + (row - ytab.index[first]);
+		if (t < last)
+			accumulateRow(&vrow[i & 1][0], &grow[0], ytab.weight[t], width);
+	}
+
+	// complete the destination rows that are covered by no further rows
+	while (dst_row < i_height && (ytab.start[dst_row] == ytab.start[dst_row+1] 
+		|| ytab.index[ytab.start[dst_row+1] - 1] <= row))
+	{
+		float *i_data = (float *) int_img->imageData + dst_row * i_step;
+		std::vector<float> &v = vrow[dst_row & 1];
+
+		// average the source columns that each destination pixel covers
+		for (int j = 0; j < i_width; j++)
+		{
+			float sum = 0.0f;
+			for (int t = xtab.start[j]; t < xtab.start[j+1]; t++)
+				sum += v[xtab.index[t]] * xtab.weight[t];
+			i_data[j] = sum;
+		}
+
+		// cells are the sum of the row so far plus the cell above
+		integrateRow(i_data, dst_row ? i_data - i_step : NULL, i_width);
+
+		std::fill(v.begin(), v.end(), 0.0f);
+		dst_row++;
+	}
+	row++;
+}
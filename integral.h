@@ -12,6 +12,7 @@
 #define _OPENSURF_INTEGRALH
 
 #include <algorithm>  // req'd for std::min/max
+#include <vector>
 
 // undefine VS macros
 #ifdef min
@@ -24,10 +25,75 @@
 
 #include "opencv/cv.h"
 
+// use SSE2 instructions when the compiler targets them
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define OPENSURF_SSE2
+#include <emmintrin.h>
+#endif
+
 //! Computes the integral image of image img.  Assumes source image to be a 
-//! 32-bit floating point.  Returns IplImage in 32-bit float form.
+//! 8-bit gray, BGR or BGRA image.  Returns IplImage in 32-bit float form.
 IplImage *Integral(IplImage *img);
 
+//! Computes the integral image of 8-bit gray (1 channel), BGR (3 channels) or 
+//! BGRA (4 channels) pixels directly into the preallocated int_img, converting 
+//! them to gray in the same pass.  The pixels must have the size of int_img.
+//! Color pixels are RGB or RGBA instead when rgb is set.
+void Integral(const unsigned char *data, int width, int height, int step, int channels, IplImage *int_img, bool rgb = false);
+
+class IntegralAreaStream;
+
+//! Same as above, but for pixels that are larger than int_img.  They are shrunk
+//! to the size of int_img by averaging the area that each pixel of int_img covers,
+//! using the buffers of the stream, which are reused from one image to the next.
+void IntegralArea(const unsigned char *data, int width, int height, int step, int channels, IplImage *int_img, 
+				  IntegralAreaStream &stream, bool rgb = false);
+
+//! Describes which source pixels contribute to each destination pixel when 
+//! shrinking a row or column of src pixels to dst pixels by area averaging
+struct AreaTable
+{
+	std::vector<int> start;    // first tap of each destination pixel, plus the end
+	std::vector<int> index;    // source pixel of each tap
+	std::vector<float> weight; // fraction of the destination pixel it covers
+};
+
+//! Same as IntegralArea, but for pixels that arrive one row at a time from top
+//! to bottom, e.g. while the image is decoded. Only a few rows are kept, so the
+//! image never has to exist in memory at its full size. The tables and rows are
+//! kept between images, so a stream that is started again allocates nothing as
+//! long as the images do not grow
+class IntegralAreaStream
+{
+public:
+	IntegralAreaStream();
+
+	//! Prepare for a width x height image whose rows are added one at a time
+	void start(int width, int height, int channels, IplImage *int_img, bool rgb = false);
+
+	//! Add the next row of width pixels
+	void addRow(const unsigned char *data);
+
+private:
+	int width, channels;
+	IplImage *int_img;
+
+	//! Positions of the blue and red values within a color pixel
+	int blue, red;
+
+	//! Next source row, and the first destination row that is not yet complete
+	int row, dst_row;
+
+	//! Blue, green and red lookup tables that directly give the gray value
+	float lut[3][256];
+
+	AreaTable xtab, ytab;
+
+	//! Gray values of the current row, and the vertical averages of the two
+	//! destination rows it may cover
+	std::vector<float> grow, vrow[2];
+};
+
 
 //! Computes the sum of pixels within the rectangle specified by the top-left start
 //! co-ordinate and size
@@ -51,4 +117,107 @@ inline float BoxIntegral(IplImage *img, int row, int col, int rows, int cols)
 	return std::max(0.f, A - B - C + D);
 }
 
+//! Offsets of the four corners of a box in the integral image, relative to
+//! the pixel at which the filter response is calculated
+struct BoxCorners 
+{
+	int a, b, c, d;
+
+	//! Set the corners of the box with the given top-left start relative to
+	//! the pixel and the given size, in the same way as BoxIntegral does
+	void set(int row, int col, int rows, int cols, int step)
+	{
+		a = (row - 1) * step + (col - 1);
+		b = (row - 1) * step + (col + cols - 1);
+		c = (row + rows - 1) * step + (col - 1);
+		d = (row + rows - 1) * step + (col + cols - 1);
+	}
+
+	//! Spread the corners over an integral image in which the given number of
+	//! images are interleaved pixel by pixel, after they were set with the 
+	//! step of a single image
+	void interleave(int lanes)
+	{
+		a *= lanes;
+		b *= lanes;
+		c *= lanes;
+		d *= lanes;
+	}
+
+	//! Sum of the pixels within the box, the same as BoxIntegral but without
+	//! any bounds checks
+	inline float sum(const float *p) const
+	{
+		return std::max(0.f, p[a] - p[b] - p[c] + p[d]);
+	}
+
+#ifdef OPENSURF_SSE2
+	//! Sums of the pixels within the boxes of four pixels that lie apart 
+	//! the given number of columns
+	inline __m128 sum4(const float *p, int cstep) const
+	{
+		__m128 A = _mm_setr_ps(p[a], p[a+cstep], p[a+2*cstep], p[a+3*cstep]);
+		__m128 B = _mm_setr_ps(p[b], p[b+cstep], p[b+2*cstep], p[b+3*cstep]);
+		__m128 C = _mm_setr_ps(p[c], p[c+cstep], p[c+2*cstep], p[c+3*cstep]);
+		__m128 D = _mm_setr_ps(p[d], p[d+cstep], p[d+2*cstep], p[d+3*cstep]);
+		return _mm_max_ps(_mm_setzero_ps(), _mm_add_ps(_mm_sub_ps(_mm_sub_ps(A, B), C), D));
+	}
+
+	//! Sums of the pixels within the boxes of four arbitrary pixels
+	inline __m128 sum4(const float *p0, const float *p1, const float *p2, const float *p3) const
+	{
+		__m128 A = _mm_setr_ps(p0[a], p1[a], p2[a], p3[a]);
+		__m128 B = _mm_setr_ps(p0[b], p1[b], p2[b], p3[b]);
+		__m128 C = _mm_setr_ps(p0[c], p1[c], p2[c], p3[c]);
+		__m128 D = _mm_setr_ps(p0[d], p1[d], p2[d], p3[d]);
+		return _mm_max_ps(_mm_setzero_ps(), _mm_add_ps(_mm_sub_ps(_mm_sub_ps(A, B), C), D));
+	}
+
+	//! Sums of the pixels within the boxes of the same pixel of four images
+	//! that are interleaved pixel by pixel (see interleave)
+	inline __m128 sumLanes(const float *p) const
+	{
+		__m128 A = _mm_loadu_ps(p + a);
+		__m128 B = _mm_loadu_ps(p + b);
+		__m128 C = _mm_loadu_ps(p + c);
+		__m128 D = _mm_loadu_ps(p + d);
+		return _mm_max_ps(_mm_setzero_ps(), _mm_add_ps(_mm_sub_ps(_mm_sub_ps(A, B), C), D));
+	}
+#endif
+};
+
+//! Same as BoxCorners, but for a box whose start, size and integral image step
+//! are known at compile time, so its corners become constant offsets
+template <int ROW, int COL, int ROWS, int COLS, int STEP>
+struct FixedBox 
+{
+	enum 
+	{
+		a = (ROW - 1) * STEP + (COL - 1),
+		b = (ROW - 1) * STEP + (COL + COLS - 1),
+		c = (ROW + ROWS - 1) * STEP + (COL - 1),
+		d = (ROW + ROWS - 1) * STEP + (COL + COLS - 1)
+	};
+
+	//! Sum of the pixels within the box, without any bounds checks
+	static inline float sum(const float *p)
+	{
+		return std::max(0.f, p[a] - p[b] - p[c] + p[d]);
+	}
+
+#ifdef OPENSURF_SSE2
+	//! Sums of the pixels within the boxes of four pixels that lie apart 
+	//! CSTEP columns
+	template <int CSTEP>
+	static inline __m128 sum4(const float *p)
+	{
+		__m128 A = _mm_setr_ps(p[a], p[a+CSTEP], p[a+2*CSTEP], p[a+3*CSTEP]);
+		__m128 B = _mm_setr_ps(p[b], p[b+CSTEP], p[b+2*CSTEP], p[b+3*CSTEP]);
+		__m128 C = _mm_setr_ps(p[c], p[c+CSTEP], p[c+2*CSTEP], p[c+3*CSTEP]);
+		__m128 D = _mm_setr_ps(p[d], p[d+CSTEP], p[d+2*CSTEP], p[d+3*CSTEP]);
+		return _mm_max_ps(_mm_setzero_ps(), _mm_add_ps(_mm_sub_ps(_mm_sub_ps(A, B), C), D));
+	}
+#endif
+};
+
 #endif
\ No newline at end of file
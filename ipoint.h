@@ -42,7 +42,7 @@ public:
 	~OpenSurfInterestPoint() {};
 
 	//! Constructor
-	OpenSurfInterestPoint() : orientation(0) {};
+	OpenSurfInterestPoint() : orientation(0), response(0) {};
 
 	//! Gets the distance in descriptor space between Ipoints
 	float operator-(const OpenSurfInterestPoint &rhs)
@@ -65,6 +65,9 @@ public:
 	//! Sign of laplacian for fast matching purposes
 	int laplacian;
 
+	//! Determinant of hessian response at the detected position, i.e. strength
+	float response;
+
 	//! Vector of descriptor components
 	float descriptor[OPENSURF_FEATURECOUNT];
 
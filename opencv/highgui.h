@@ -202,6 +202,32 @@ CVAPI(void) cvSetMouseCallback( const char* window_name, CvMouseCallback on_mous
 CVAPI(IplImage*) cvLoadImage( const char* filename, int iscolor CV_DEFAULT(CV_LOAD_IMAGE_COLOR));
 CVAPI(CvMat*) cvLoadImageM( const char* filename, int iscolor CV_DEFAULT(CV_LOAD_IMAGE_COLOR));
 
+/* load image from file, reduced in size while decoding where the format allows it
+  (currently jpeg, by 1/2, 1/4 or 1/8) as long as both dimensions remain at least
+  min_size pixels. the image is loaded at full size otherwise
+*/
+CVAPI(IplImage*) cvLoadImageReduced( const char* filename, int iscolor, int min_size );
+
+/* receives the rows of an image that is loaded one row at a time */
+typedef struct CvImageRowReader
+{
+    /* called once the (reduced) size of the image is known, before any of its
+       rows. returning zero stops loading the image */
+    int  (CV_CDECL *start)( struct CvImageRowReader* reader, CvSize size, int channels );
+    /* called for every row of 8-bit pixels from top to bottom. the row is only
+       valid during the call */
+    void (CV_CDECL *row)( struct CvImageRowReader* reader, const uchar* row );
+}
+CvImageRowReader;
+
+/* load image from file one row at a time, reduced in size in the same way as
+  cvLoadImageReduced. jpeg and non-interlaced png images are decoded row by row
+  without ever holding the entire image in memory, other formats are decoded
+  entirely first. returns 1 when all rows were read, 0 when the reader stopped
+  loading the image and -1 when it could not be loaded
+*/
+CVAPI(int) cvLoadImageRows( const char* filename, int iscolor, int min_size, CvImageRowReader* reader );
+
 #define CV_IMWRITE_JPEG_QUALITY 1
 #define CV_IMWRITE_PNG_COMPRESSION 16
 #define CV_IMWRITE_PXM_BINARY 32
@@ -214,6 +240,15 @@ CVAPI(int) cvSaveImage( const char* filename, const CvArr* image,
 CVAPI(IplImage*) cvDecodeImage( const CvMat* buf, int iscolor CV_DEFAULT(CV_LOAD_IMAGE_COLOR));
 CVAPI(CvMat*) cvDecodeImageM( const CvMat* buf, int iscolor CV_DEFAULT(CV_LOAD_IMAGE_COLOR));
 
+/* decode image stored in the buffer, reduced in size in the same way as
+   cvLoadImageReduced */
+CVAPI(IplImage*) cvDecodeImageReduced( const CvMat* buf, int iscolor, int min_size );
+
+/* decode image stored in the buffer one row at a time, in the same way as
+   cvLoadImageRows. returns 0 as well for formats that cannot be decoded from
+   memory directly, which cvDecodeImageReduced can still decode */
+CVAPI(int) cvDecodeImageRows( const CvMat* buf, int iscolor, int min_size, CvImageRowReader* reader );
+
 /* encode image and store the result as a byte vector (single-row 8uC1 matrix) */
 CVAPI(CvMat*) cvEncodeImage( const char* ext, const CvArr* image,
                              const int* params CV_DEFAULT(0) );
@@ -86,6 +86,22 @@ ImageDecoder BaseImageDecoder::newDecoder() const
     return ImageDecoder();
 }
 
+int BaseImageDecoder::setScale( int )
+{
+    return 1;
+}
+
+bool BaseImageDecoder::readRows( int type, ImageRowSink& sink )
+{
+    Mat img( m_height, m_width, type );
+    if( !readData( img ))
+        return false;
+
+    for( int y = 0; y < img.rows; y++ )
+        sink.putRow( img.ptr(y) );
+    return true;
+}
+
 BaseImageEncoder::BaseImageEncoder()
 {
     m_buf_supported = false;
@@ -54,6 +54,15 @@ class BaseImageEncoder;
 typedef Ptr<BaseImageEncoder> ImageEncoder;
 typedef Ptr<BaseImageDecoder> ImageDecoder;
 
+///////////////////////////// receiver of decoded rows ////////////////////////////
+class ImageRowSink
+{
+public:
+    virtual ~ImageRowSink() {};
+    // called for every row of the image from top to bottom
+    virtual void putRow( const uchar* row ) = 0;
+};
+
 ///////////////////////////////// base class for decoders ////////////////////////
 class BaseImageDecoder
 {
@@ -70,6 +79,16 @@ public:
     virtual bool readHeader() = 0;
     virtual bool readData( Mat& img ) = 0;
 
+    // asks the decoder to shrink the image by 1/denom while decoding, which is
+    // called after readHeader and updates width() and height(). returns the
+    // denominator that will be used, which is 1 when the format does not support it
+    virtual int setScale( int denom );
+
+    // decodes the image into a single row of the given type at a time, which is
+    // handed to the sink before the next row is decoded. formats that cannot be
+    // decoded row by row are decoded entirely first
+    virtual bool readRows( int type, ImageRowSink& sink );
+
     virtual size_t signatureLength() const;
     virtual bool checkSignature( const string& signature ) const;
     virtual ImageDecoder newDecoder() const;
@@ -219,12 +219,14 @@ bool  JpegDecoder::readHeader()
             if( m_f )
                 jpeg_stdio_src( &state->cinfo, m_f );
         }
-        jpeg_read_header( &state->cinfo, TRUE );
-
-        m_width = state->cinfo.image_width;
-        m_height = state->cinfo.image_height;
-        m_type = state->cinfo.num_components > 1 ? CV_8UC3 : CV_8UC1;
-        result = true;
+        // Note: a buffer that ends within the header suspends reading it
+        if( jpeg_read_header( &state->cinfo, TRUE ) == JPEG_HEADER_OK )
+        {
+            m_width = state->cinfo.image_width;
+            m_height = state->cinfo.image_height;
+            m_type = state->cinfo.num_components > 1 ? CV_8UC3 : CV_8UC1;
+            result = true;
+        }
     }
 
     if( !result )
@@ -233,6 +235,29 @@ bool  JpegDecoder::readHeader()
     return result;
 }
 
+/* libjpeg scales the DCT blocks while decoding, so a reduced image costs only
+   a fraction of the time of decoding it at full size */
+int JpegDecoder::setScale( int denom )
+{
+    JpegState* state = (JpegState*)m_state;
+    if( !state || denom <= 1 )
+        return 1;
+
+    if( setjmp( state->jerr.setjmp_buffer ) == 0 )
+    {
+        state->cinfo.scale_num = 1;
+        state->cinfo.scale_denom = denom;
+        jpeg_calc_output_dimensions( &state->cinfo );
+
+        m_width = state->cinfo.output_width;
+        m_height = state->cinfo.output_height;
+        return denom;
+    }
+
+    state->cinfo.scale_num = state->cinfo.scale_denom = 1;
+    return 1;
+}
+
 /***************************************************************************
  * following code is for supporting MJPEG image files
  * based on a message of Laurent Pinchart on the video4linux mailing list
@@ -368,10 +393,21 @@ int my_jpeg_load_dht (struct jpeg_decompress_struct *info, unsigned char *dht,
  ***************************************************************************/
 
 bool  JpegDecoder::readData( Mat& img )
+{
+    return decode( img, 0 );
+}
+
+bool  JpegDecoder::readRows( int type, ImageRowSink& sink )
+{
+    Mat row( 1, m_width, type );
+    return decode( row, &sink );
+}
+
+bool  JpegDecoder::decode( Mat& img, ImageRowSink* sink )
 {
     bool result = false;
     uchar* data = img.data;
-    int step = img.step;
+    int step = sink ? 0 : img.step;
     bool color = img.channels() > 1;
     JpegState* state = (JpegState*)m_state;
 
@@ -446,6 +482,8 @@ bool  JpegDecoder::readData( Mat& img )
                     else
                         icvCvt_CMYK2Gray_8u_C4C1R( buffer[0], 0, data, 0, cvSize(m_width,1) );
                 }
+                if( sink )
+                    sink->putRow( data );
             }
             result = true;
             jpeg_finish_decompress( cinfo );
@@ -63,11 +63,17 @@ public:
     bool  readData( Mat& img );
     bool  readHeader();
     void  close();
+    int   setScale( int denom );
+    bool  readRows( int type, ImageRowSink& sink );
 
     ImageDecoder newDecoder() const;
 
 protected:
 
+    // decodes into img, or one row at a time into the single row img that is
+    // handed to the sink when there is one
+    bool  decode( Mat& img, ImageRowSink* sink );
+
     FILE* m_f;
     void* m_state;
 };
@@ -188,13 +188,29 @@ bool  PngDecoder::readHeader()
 
 
 bool  PngDecoder::readData( Mat& img )
+{
+    return decode( img, 0 );
+}
+
+bool  PngDecoder::readRows( int type, ImageRowSink& sink )
+{
+    // interlaced images only become complete in their last pass
+    if( m_png_ptr && m_info_ptr &&
+        png_get_interlace_type( (png_structp)m_png_ptr, (png_infop)m_info_ptr ) != PNG_INTERLACE_NONE )
+        return BaseImageDecoder::readRows( type, sink );
+
+    Mat row( 1, m_width, type );
+    return decode( row, &sink );
+}
+
+bool  PngDecoder::decode( Mat& img, ImageRowSink* sink )
 {
     bool result = false;
-    AutoBuffer<uchar*> _buffer(m_height);
+    AutoBuffer<uchar*> _buffer(sink ? 1 : m_height);
     uchar** buffer = _buffer;
     int color = img.channels() > 1;
     uchar* data = img.data;
-    int step = img.step;
+    int step = sink ? 0 : img.step;
 
     if( m_png_ptr && m_info_ptr && m_end_info && m_width && m_height )
     {
@@ -206,6 +222,7 @@ bool  PngDecoder::readData( Mat& img )
         if( setjmp( png_jmpbuf(png_ptr)) == 0 )
         {
             int y;
+            bool gray_rows = false;
 
             if( img.depth() == CV_8U && m_bit_depth == 16 )
                 png_set_strip_16( png_ptr );
@@ -233,15 +250,41 @@ bool  PngDecoder::readData( Mat& img )
                 png_set_bgr( png_ptr ); // convert RGB to BGR
             else if( color )
                 png_set_gray_to_rgb( png_ptr ); // Gray->RGB
-            else
+            else if( CV_MAT_CN(m_type) == 1 || img.depth() != CV_8U ||
+                     png_get_interlace_type( png_ptr, info_ptr ) != PNG_INTERLACE_NONE )
                 png_set_rgb_to_gray( png_ptr, 1, -1, -1 ); // RGB->Gray
+            else
+                gray_rows = true;
 
             png_read_update_info( png_ptr, info_ptr );
 
-            for( y = 0; y < m_height; y++ )
-                buffer[y] = data + y*step;
+            if( gray_rows || sink )
+            {
+                // RGB->Gray one row at a time as the rows are decoded, so the
+                // image never exists in color, using the weights and rounding of
+                // CV_BGR2GRAY rather than those of libpng
+                AutoBuffer<uchar> _row(gray_rows ? m_width*3 : 1);
+                uchar* row = _row;
+                for( y = 0; y < m_height; y++ )
+                {
+                    if( gray_rows )
+                    {
+                        png_read_row( png_ptr, row, NULL );
+                        icvCvt_BGR2Gray_8u_C3C1R( row, 0, data + y*step, 0, cvSize(m_width,1), 1 );
+                    }
+                    else
+                        png_read_row( png_ptr, data + y*step, NULL );
+                    if( sink )
+                        sink->putRow( data + y*step );
+                }
+            }
+            else
+            {
+                for( y = 0; y < m_height; y++ )
+                    buffer[y] = data + y*step;
 
-            png_read_image( png_ptr, buffer );
+                png_read_image( png_ptr, buffer );
+            }
             png_read_end( png_ptr, end_info );
 
             result = true;
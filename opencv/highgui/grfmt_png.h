@@ -61,11 +61,16 @@ public:
     bool  readData( Mat& img );
     bool  readHeader();
     void  close();
+    bool  readRows( int type, ImageRowSink& sink );
 
     ImageDecoder newDecoder() const;
 
 protected:
 
+    // decodes into img, or one row at a time into the single row img that is
+    // handed to the sink when there is one
+    bool  decode( Mat& img, ImageRowSink* sink );
+
     static void readDataFromBuf(void* png_ptr, uchar* dst, size_t size);
 
     int   m_bit_depth;
@@ -195,25 +195,34 @@ static ImageCodecInitializer initialize_codecs;
 
 enum { LOAD_CVMAT=0, LOAD_IMAGE=1, LOAD_MAT=2 };
 
-static void*
-imread_( const string& filename, int flags, int hdrtype, Mat* mat=0 )
+// lets the decoder shrink the image by the largest factor of 1/2, 1/4 or 1/8
+// that still leaves at least min_size pixels in each dimension
+static CvSize
+reduceSize( ImageDecoder& decoder, int min_size )
 {
-    IplImage* image = 0;
-    CvMat *matrix = 0;
-    Mat temp, *data = &temp;
-
-    ImageDecoder decoder = findDecoder(filename);
-    if( decoder.empty() )
-        return 0;
-    decoder->setSource(filename);
-    if( !decoder->readHeader() )
-        return 0;
-
     CvSize size;
     size.width = decoder->width();
     size.height = decoder->height();
 
-    int type = decoder->type();
+    if( min_size > 0 )
+    {
+        int denom = 8;
+        while( denom > 1 && ((size.width + denom - 1)/denom < min_size ||
+                             (size.height + denom - 1)/denom < min_size) )
+            denom /= 2;
+        if( denom > 1 && decoder->setScale( denom ) > 1 )
+        {
+            size.width = decoder->width();
+            size.height = decoder->height();
+        }
+    }
+    return size;
+}
+
+// the type of the loaded image for the given load flags
+static int
+loadType( int type, int flags )
+{
     if( flags != -1 )
     {
         if( (flags & CV_LOAD_IMAGE_ANYDEPTH) == 0 )
@@ -225,6 +234,25 @@ imread_( const string& filename, int flags, int hdrtype, Mat* mat=0 )
         else
             type = CV_MAKETYPE(CV_MAT_DEPTH(type), 1);
     }
+    return type;
+}
+
+static void*
+imread_( const string& filename, int flags, int hdrtype, Mat* mat=0, int min_size=0 )
+{
+    IplImage* image = 0;
+    CvMat *matrix = 0;
+    Mat temp, *data = &temp;
+
+    ImageDecoder decoder = findDecoder(filename);
+    if( decoder.empty() )
+        return 0;
+    decoder->setSource(filename);
+    if( !decoder->readHeader() )
+        return 0;
+
+    CvSize size = reduceSize( decoder, min_size );
+    int type = loadType( decoder->type(), flags );
 
     if( hdrtype == LOAD_CVMAT || hdrtype == LOAD_MAT )
     {
@@ -304,7 +332,7 @@ bool imwrite( const string& filename, const Mat& img,
 }
 
 static void*
-imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0 )
+imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0, int min_size=0 )
 {
     CV_Assert(buf.data && buf.isContinuous());
     IplImage* image = 0;
@@ -324,7 +352,7 @@ imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0 )
         if( !f )
             return 0;
         size_t bufSize = buf.cols*buf.rows*buf.elemSize();
-        fwrite( &buf.data, 1, bufSize, f );
+        fwrite( buf.data, 1, bufSize, f );
         fclose(f);
         decoder->setSource(filename);
     }
@@ -341,22 +369,8 @@ imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0 )
         return 0;
     }
 
-    CvSize size;
-    size.width = decoder->width();
-    size.height = decoder->height();
-
-    int type = decoder->type();
-    if( flags != -1 )
-    {
-        if( (flags & CV_LOAD_IMAGE_ANYDEPTH) == 0 )
-            type = CV_MAKETYPE(CV_8U, CV_MAT_CN(type));
-
-        if( (flags & CV_LOAD_IMAGE_COLOR) != 0 ||
-           ((flags & CV_LOAD_IMAGE_ANYCOLOR) != 0 && CV_MAT_CN(type) > 1) )
-            type = CV_MAKETYPE(CV_MAT_DEPTH(type), 3);
-        else
-            type = CV_MAKETYPE(CV_MAT_DEPTH(type), 1);
-    }
+    CvSize size = reduceSize( decoder, min_size );
+    int type = loadType( decoder->type(), flags );
 
     if( hdrtype == LOAD_CVMAT || hdrtype == LOAD_MAT )
     {
@@ -497,6 +511,55 @@ cvLoadImageM( const char* filename, int iscolor )
     return (CvMat*)cv::imread_( filename, iscolor, cv::LOAD_CVMAT );
 }
 
+CV_IMPL IplImage*
+cvLoadImageReduced( const char* filename, int iscolor, int min_size )
+{
+    return (IplImage*)cv::imread_( filename, iscolor, cv::LOAD_IMAGE, 0, min_size );
+}
+
+namespace cv
+{
+
+// hands the decoded rows to the reader
+class ImageRowReaderSink : public ImageRowSink
+{
+public:
+    ImageRowReaderSink( CvImageRowReader* reader ) : reader(reader) {}
+    void putRow( const uchar* row ) { reader->row( reader, row ); }
+
+private:
+    CvImageRowReader* reader;
+};
+
+static int
+readRows_( ImageDecoder& decoder, int flags, int min_size, CvImageRowReader* reader )
+{
+    if( !decoder->readHeader() )
+        return -1;
+
+    CvSize size = reduceSize( decoder, min_size );
+    int type = loadType( decoder->type(), flags );
+    if( CV_MAT_DEPTH(type) != CV_8U )
+        return -1;
+    if( !reader->start( reader, size, CV_MAT_CN(type) ) )
+        return 0;
+
+    ImageRowReaderSink sink( reader );
+    return decoder->readRows( type, sink ) ? 1 : -1;
+}
+
+}
+
+CV_IMPL int
+cvLoadImageRows( const char* filename, int iscolor, int min_size, CvImageRowReader* reader )
+{
+    cv::ImageDecoder decoder = cv::findDecoder(filename);
+    if( decoder.empty() )
+        return -1;
+    decoder->setSource(filename);
+    return cv::readRows_( decoder, iscolor, min_size, reader );
+}
+
 CV_IMPL int
 cvSaveImage( const char* filename, const CvArr* arr, const int* _params )
 {
@@ -528,6 +591,29 @@ cvDecodeImageM( const CvMat* _buf, int iscolor )
     return (CvMat*)cv::imdecode_(buf, iscolor, cv::LOAD_CVMAT );
 }
 
+CV_IMPL IplImage*
+cvDecodeImageReduced( const CvMat* _buf, int iscolor, int min_size )
+{
+    CV_Assert( _buf && CV_IS_MAT_CONT(_buf->type) );
+    cv::Mat buf(1, _buf->rows*_buf->cols*CV_ELEM_SIZE(_buf->type), CV_8U, _buf->data.ptr);
+    return (IplImage*)cv::imdecode_(buf, iscolor, cv::LOAD_IMAGE, 0, min_size );
+}
+
+CV_IMPL int
+cvDecodeImageRows( const CvMat* _buf, int iscolor, int min_size, CvImageRowReader* reader )
+{
+    CV_Assert( _buf && CV_IS_MAT_CONT(_buf->type) );
+    cv::Mat buf(1, _buf->rows*_buf->cols*CV_ELEM_SIZE(_buf->type), CV_8U, _buf->data.ptr);
+    cv::ImageDecoder decoder = cv::findDecoder(buf);
+    if( decoder.empty() )
+        return -1;
+    // formats that cannot be decoded from memory go through a temporary file
+    // in cvDecodeImageReduced instead
+    if( !decoder->setSource(buf) )
+        return 0;
+    return cv::readRows_( decoder, iscolor, min_size, reader );
+}
+
 CV_IMPL CvMat*
 cvEncodeImage( const char* ext, const CvArr* arr, const int* _params )
 {
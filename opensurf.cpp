@@ -25,82 +25,484 @@
 #include "integral.h"
 #include "fasthessian.h"
 #include "surf.h"
+#include "threadpool.h"
 
-OpenSurf::OpenSurf(int imagedim)
+OpenSurfParameters::OpenSurfParameters()
+{
+	octaves = OCTAVES;
+	intervals = INTERVALS;
+	init_sample = INIT_SAMPLE;
+	thres = THRES;
+	upright = false;
+}
+
+bool OpenSurfParameters::operator==(const OpenSurfParameters &other) const
+{
+	return octaves == other.octaves && intervals == other.intervals && init_sample == other.init_sample &&
+		thres == other.thres && upright == other.upright;
+}
+
+bool OpenSurfParameters::operator!=(const OpenSurfParameters &other) const
+{
+	return !(*this == other);
+}
+
+OpenSurfImageView::OpenSurfImageView(const unsigned char *data, int width, int height, int step, int channels, bool rgb)
+	: data(data), width(width), height(height), step(step), channels(channels), rgb(rgb)
+{
+}
+
+OpenSurfWorkspace::OpenSurfWorkspace()
+{
+	m_resized = NULL;
+	m_integral = NULL;
+	m_area = NULL;
+	m_fasthessian = NULL;
+	m_haarmaps = NULL;
+	m_pool = NULL;
+}
+
+OpenSurfWorkspace::~OpenSurfWorkspace()
+{
+	if (m_resized)
+		cvReleaseImage(&m_resized);
+	if (m_integral)
+		cvReleaseImage(&m_integral);
+	SAFE_DELETE(m_area);
+	SAFE_DELETE(m_fasthessian);
+	SAFE_DELETE(m_haarmaps);
+	SAFE_DELETE(m_pool);
+}
+
+OpenSurf::OpenSurf(int imagedim, bool haarmaps, int threads)
 {
 	m_imagedim = imagedim;
+	m_haarmaps = haarmaps;
+	m_threads = threads;
+	m_maxpoints = 0;
+	m_spread = false;
+	m_timebudget = 0;
+	m_enoughpoints = 0;
 }
 
 OpenSurf::~OpenSurf()
 {
 }
 
+void OpenSurf::SetParameters(const OpenSurfParameters &parameters)
+{
+	m_parameters = parameters;
+}
+
+const OpenSurfParameters &OpenSurf::GetParameters() const
+{
+	return m_parameters;
+}
+
+void OpenSurf::SetPointBudget(int maxpoints, bool spread)
+{
+	m_maxpoints = maxpoints > 0 ? maxpoints : 0;
+	m_spread = spread;
+}
+
+// compare the strength of two interest points by their response, where ties
+// are broken by the order in which the points were detected
+struct OpenSurfStrength
+{
+	float value;
+	int index;
+	bool operator<(const OpenSurfStrength &other) const
+	{
+		if (value != other.value)
+			return value > other.value;
+		return index < other.index;
+	}
+};
+
+// keep the maxpoints strongest interest points, or when spread is set the points
+// with the largest suppression radius, which is the distance to the nearest point
+// that is sufficiently stronger (see Brown et al., Multi-image matching using
+// multi-scale oriented patches, CVPR 2005)
+// Note: the kept points remain in the order in which they were detected
+static void SelectPoints(vector<OpenSurfInterestPoint> &points, int maxpoints, bool spread)
+{
+	const int count = (int)points.size();
+	vector<OpenSurfStrength> strength(count);
+	for (int i = 0; i < count; i++)
+	{
+		strength[i].value = points[i].response;
+		strength[i].index = i;
+	}
+	if (spread)
+	{
+		// visit the points from strong to weak, so only the points visited
+		// before can suppress the current point
+		const float robust = 0.9f;
+		sort(strength.begin(), strength.end());
+		vector<OpenSurfStrength> radius(count);
+		for (int i = 0; i < count; i++)
+		{
+			const OpenSurfInterestPoint &p = points[strength[i].index];
+			float nearest = FLT_MAX;
+			for (int j = 0; j < i && strength[j].value * robust > strength[i].value; j++)
+			{
+				const OpenSurfInterestPoint &q = points[strength[j].index];
+				nearest = min(nearest, (p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y));
+			}
+			radius[i].value = nearest;
+			radius[i].index = strength[i].index;
+		}
+		strength.swap(radius);
+	}
+	nth_element(strength.begin(), strength.begin() + maxpoints, strength.end());
+	vector<bool> keep(count, false);
+	for (int i = 0; i < maxpoints; i++)
+		keep[strength[i].index] = true;
+	int kept = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (keep[i])
+			points[kept++] = points[i];
+	}
+	points.resize(kept);
+}
+
+void OpenSurf::SetTimeBudget(int milliseconds, int enoughpoints)
+{
+	m_timebudget = milliseconds > 0 ? milliseconds : 0;
+	m_enoughpoints = enoughpoints > 0 ? enoughpoints : 0;
+}
+
+void OpenSurf::SetHaarMaps(bool haarmaps)
+{
+	m_haarmaps = haarmaps;
+}
+
+IplImage *OpenSurf::LoadImage(const char *fname) const
+{
+	// only jpeg images can be reduced while decoding, which then costs a fraction
+	// of the time of decoding them at full size
+	// Note: the reduced image is never smaller than the image dimension, so it is
+	//       still resized in the same way as any other image
+	// Note: the interest points are found in gray images, so the image is decoded
+	//       straight to gray. jpeg images then skip decoding their color channels
+	//       altogether and png images are converted while decoding, after which
+	//       the image takes a third of the memory of a color image
+	return cvLoadImageReduced(fname, CV_LOAD_IMAGE_GRAYSCALE, m_imagedim);
+}
+
+IplImage *OpenSurf::DecodeImage(const unsigned char *encoded, size_t length) const
+{
+	if (encoded == NULL || length == 0 || length > INT_MAX)
+		return NULL;
+	// Note: the buffer is only read, even though opencv wants it to be writable
+	CvMat buf = cvMat(1, (int)length, CV_8UC1, (void *)encoded);
+	return cvDecodeImageReduced(&buf, CV_LOAD_IMAGE_GRAYSCALE, m_imagedim);
+}
+
 bool OpenSurf::ExtractDescriptor(IplImage &image, float *&descriptor, int &ipoints)
 {
-	// resize image
-	IplImage *small = cvCreateImage(cvSize(m_imagedim, m_imagedim), IPL_DEPTH_8U, 3);
-	cvResize(&image, small, CV_INTER_CUBIC);
-	// create the integral image
-	IplImage *integral = Integral(small);
-	cvReleaseImage(&small);
-	// start finding the SURF points
-	vector<OpenSurfInterestPoint> ivector;
-	ivector.reserve(2000);	
-	// extract interest points
-	FastHessian fh(integral, ivector, OCTAVES, INTERVALS, INIT_SAMPLE, THRES);
-	fh.getIpoints();
-	if (ivector.empty())
+	// extract the interest points
+	OpenSurfWorkspace workspace;
+	const OpenSurfInterestPoint *points;
+	if (!ExtractDescriptor(image, workspace, points, ipoints))
+		return false;
+	if (ipoints == 0)
 	{
-		ipoints = 0;
 		descriptor = NULL;
 		return true;
 	}
-	// extract descriptors
-	Surf des(integral, ivector);
-	des.getDescriptors(false);
-	cvReleaseImage(&integral);
 	// save the points
-	ipoints = (int)ivector.size();
 	descriptor = NEW float[ipoints * OPENSURF_FEATURECOUNT];
 	float *f = descriptor;
-	for (vector<OpenSurfInterestPoint>::const_iterator it = ivector.begin(); it != ivector.end(); ++it, f += OPENSURF_FEATURECOUNT)
-		memcpy(f, (*it).descriptor, OPENSURF_FEATURECOUNT * sizeof(float));
+	for (int i = 0; i < ipoints; i++, f += OPENSURF_FEATURECOUNT)
+		memcpy(f, points[i].descriptor, OPENSURF_FEATURECOUNT * sizeof(float));
 	return true;
 }
 
 bool OpenSurf::ExtractDescriptor(IplImage &image, OpenSurfInterestPoint *&points, int &ipoints)
 {
-	// resize image
-	IplImage *small = cvCreateImage(cvSize(m_imagedim, m_imagedim), IPL_DEPTH_8U, 3);
-	cvResize(&image, small, CV_INTER_CUBIC);
-	// create the integral image
-	IplImage *integral = Integral(small);
-	cvReleaseImage(&small);
-	// start finding the SURF points
-	vector<OpenSurfInterestPoint> ivector;
-	ivector.reserve(2000);	
-	// extract interest points
-	FastHessian fh(integral, ivector, OCTAVES, INTERVALS, INIT_SAMPLE, THRES);
-	fh.getIpoints();
-	if (ivector.empty())
+	// extract the interest points
+	OpenSurfWorkspace workspace;
+	const OpenSurfInterestPoint *wpoints;
+	if (!ExtractDescriptor(image, workspace, wpoints, ipoints))
+		return false;
+	if (ipoints == 0)
 	{
-		ipoints = 0;
 		points = NULL;
 		return true;
 	}
-	// extract descriptors
-	Surf des(integral, ivector);
-	des.getDescriptors(false);
-	cvReleaseImage(&integral);
 	// save the points
-	ipoints = (int)ivector.size();
 	points = NEW OpenSurfInterestPoint[ipoints];
-	OpenSurfInterestPoint *p = points;
-	for (vector<OpenSurfInterestPoint>::const_iterator it = ivector.begin(); it != ivector.end(); ++it, p++)
-		memcpy(p, &(*it), sizeof(OpenSurfInterestPoint));
+	memcpy(points, wpoints, ipoints * sizeof(OpenSurfInterestPoint));
+	return true;
+}
+
+bool OpenSurf::ExtractDescriptor(IplImage &image, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints)
+{
+	// the time at which the extraction should be done, if any
+	const double deadline = m_timebudget > 0 ? GetMonotonicTime() + m_timebudget / 1000.0 : 0;
+	if (!PrepareWorkspace(image, workspace))
+		return false;
+	ExtractPoints(workspace, deadline, points, ipoints);
+	return true;
+}
+
+bool OpenSurf::ExtractDescriptor(const OpenSurfImageView &view, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints)
+{
+	// the time at which the extraction should be done, if any
+	const double deadline = m_timebudget > 0 ? GetMonotonicTime() + m_timebudget / 1000.0 : 0;
+	if (!PrepareWorkspace(view, workspace))
+		return false;
+	ExtractPoints(workspace, deadline, points, ipoints);
+	return true;
+}
+
+// receives the rows of an image while it is being decoded and adds them to the
+// integral image of the workspace, as long as the image is large enough to be
+// shrunk by averaging
+// Note: the reader has to come first, since the callbacks only get to see it
+struct OpenSurfRowReader
+{
+	CvImageRowReader reader;
+	IplImage *integral;
+	IntegralAreaStream *stream;
+
+	OpenSurfRowReader(IplImage *integral, IntegralAreaStream *stream) : integral(integral), stream(stream)
+	{
+		reader.start = Start;
+		reader.row = Row;
+	}
+
+	static int CV_CDECL Start(CvImageRowReader *reader, CvSize size, int channels)
+	{
+		OpenSurfRowReader *self = (OpenSurfRowReader *)reader;
+		// Note: smaller images are resized as a whole, the same as in PrepareWorkspace
+		if (size.width < 2 * self->integral->width || size.height < 2 * self->integral->height)
+			return 0;
+		self->stream->start(size.width, size.height, channels, self->integral);
+		return 1;
+	}
+	static void CV_CDECL Row(CvImageRowReader *reader, const uchar *row)
+	{
+		((OpenSurfRowReader *)reader)->stream->addRow(row);
+	}
+};
+
+bool OpenSurf::ExtractDescriptor(const char *fname, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints, bool *loaded)
+{
+	if (loaded)
+		*loaded = true;
+	if (!SetupWorkspace(workspace))
+		return false;
+	// try to decode the image straight into the integral image
+	// Note: the image is decoded to gray and reduced while decoding, in the same
+	//       way as by LoadImage, so the integral image is exactly the same as when
+	//       the whole image would have been loaded first
+	OpenSurfRowReader reader(workspace.m_integral, workspace.m_area);
+	int streamed = cvLoadImageRows(fname, CV_LOAD_IMAGE_GRAYSCALE, m_imagedim, &reader.reader);
+	// load the image entirely when it was too small to be streamed
+	IplImage *image = streamed == 0 ? LoadImage(fname) : NULL;
+	if (streamed < 0 || (streamed == 0 && image == NULL))
+	{
+		if (loaded)
+			*loaded = false;
+		else
+			SAFE_FLUSHPRINT(stderr, "could not load image %s\n", fname);
+		return false;
+	}
+	return FinishExtraction(image, workspace, points, ipoints);
+}
+
+bool OpenSurf::ExtractDescriptor(const unsigned char *encoded, size_t length, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints)
+{
+	if (encoded == NULL || length == 0 || length > INT_MAX)
+	{
+		SAFE_FLUSHPRINT(stderr, "invalid encoded image provided\n");
+		return false;
+	}
+	if (!SetupWorkspace(workspace))
+		return false;
+	// try to decode the image straight into the integral image
+	CvMat buf = cvMat(1, (int)length, CV_8UC1, (void *)encoded);
+	OpenSurfRowReader reader(workspace.m_integral, workspace.m_area);
+	int decoded = cvDecodeImageRows(&buf, CV_LOAD_IMAGE_GRAYSCALE, m_imagedim, &reader.reader);
+	// decode the image entirely when it was too small to be streamed
+	IplImage *image = decoded == 0 ? DecodeImage(encoded, length) : NULL;
+	if (decoded < 0 || (decoded == 0 && image == NULL))
+	{
+		SAFE_FLUSHPRINT(stderr, "could not decode image\n");
+		return false;
+	}
+	return FinishExtraction(image, workspace, points, ipoints);
+}
+
+bool OpenSurf::FinishExtraction(IplImage *image, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints)
+{
+	if (image)
+	{
+		bool success = ExtractDescriptor(*image, workspace, points, ipoints);
+		cvReleaseImage(&image);
+		return success;
+	}
+	workspace.m_fasthessian->setIntImage(workspace.m_integral);
+	// Note: the time budget only starts once the image has been decoded, since
+	//       decoding a huge image may well take longer than the budget itself
+	const double deadline = m_timebudget > 0 ? GetMonotonicTime() + m_timebudget / 1000.0 : 0;
+	ExtractPoints(workspace, deadline, points, ipoints);
+	return true;
+}
+
+bool OpenSurf::ExtractDescriptors(IplImage **images, int count, OpenSurfWorkspace **workspaces, const OpenSurfInterestPoint **points, int *ipoints)
+{
+	if (count <= 0)
+		return true;
+	vector<FastHessian *> batch(count);
+	for (int i = 0; i < count; i++)
+	{
+		if (!PrepareWorkspace(*images[i], *workspaces[i]))
+			return false;
+		batch[i] = workspaces[i]->m_fasthessian;
+	}
+	// extract the interest points of all images, using the worker threads of
+	// the first workspace for the entire batch
+	ThreadPool *pool = NULL;
+	if (m_threads > 1)
+	{
+		if (workspaces[0]->m_pool == NULL)
+			workspaces[0]->m_pool = NEW ThreadPool(m_threads);
+		pool = workspaces[0]->m_pool;
+	}
+	FastHessian::getBatchIpoints(&batch[0], count, workspaces[0]->m_interleaved, pool);
+	// extract the descriptors of each image
+	for (int i = 0; i < count; i++)
+		DescribePoints(*workspaces[i], pool, 0, 0, points[i], ipoints[i]);
+	return true;
+}
+
+int OpenSurf::GetBatchSize()
+{
+	return FastHessian::BATCH_LANES;
+}
+
+bool OpenSurf::SetupWorkspace(OpenSurfWorkspace &workspace)
+{
+	// allocate the buffers the first time the workspace is used
+	if (workspace.m_integral == NULL)
+	{
+		workspace.m_integral = cvCreateImage(cvSize(m_imagedim, m_imagedim), IPL_DEPTH_32F, 1);
+		workspace.m_area = NEW IntegralAreaStream;
+		workspace.m_points.reserve(2000);
+		workspace.m_fasthessian = NEW FastHessian(workspace.m_points, m_parameters.octaves, m_parameters.intervals, m_parameters.init_sample, m_parameters.thres);
+		workspace.m_parameters = m_parameters;
+	}
+	else if (workspace.m_integral->width != m_imagedim)
+	{
+		SAFE_FLUSHPRINT(stderr, "the workspace was created for a different image dimension\n");
+		return false;
+	}
+	else if (workspace.m_parameters != m_parameters)
+	{
+		workspace.m_fasthessian->saveParameters(m_parameters.octaves, m_parameters.intervals, m_parameters.init_sample, m_parameters.thres);
+		workspace.m_parameters = m_parameters;
+	}
+	return true;
+}
+
+bool OpenSurf::PrepareWorkspace(IplImage &image, OpenSurfWorkspace &workspace)
+{
+	if (image.depth != IPL_DEPTH_8U || (image.nChannels != 1 && image.nChannels != 3 && image.nChannels != 4))
+	{
+		SAFE_FLUSHPRINT(stderr, "only 8-bit gray, BGR and BGRA images are supported\n");
+		return false;
+	}
+	return PrepareWorkspace(OpenSurfImageView((const unsigned char *)image.imageData, image.width, image.height, image.widthStep, image.nChannels), workspace);
+}
+
+bool OpenSurf::PrepareWorkspace(const OpenSurfImageView &view, OpenSurfWorkspace &workspace)
+{
+	if (view.data == NULL || view.width <= 0 || view.height <= 0 || (view.channels != 1 && view.channels != 3 && view.channels != 4) ||
+		view.step < view.width * view.channels)
+	{
+		SAFE_FLUSHPRINT(stderr, "invalid image data provided\n");
+		return false;
+	}
+	if (!SetupWorkspace(workspace))
+		return false;
+	// create the integral image at the requested dimension, going straight from
+	// the pixels to the integral image whenever possible
+	// Note: when the image is shrunk by at least a factor of two we average the
+	//       pixels, which is both faster and avoids the aliasing of the cubic
+	//       interpolation at such scales
+	if (view.width == m_imagedim && view.height == m_imagedim)
+		Integral(view.data, view.width, view.height, view.step, view.channels, workspace.m_integral, view.rgb);
+	else if (view.width >= 2 * m_imagedim && view.height >= 2 * m_imagedim)
+		IntegralArea(view.data, view.width, view.height, view.step, view.channels, workspace.m_integral, *workspace.m_area, view.rgb);
+	else
+	{
+		if (workspace.m_resized == NULL || workspace.m_resized->nChannels != view.channels)
+		{
+			if (workspace.m_resized)
+				cvReleaseImage(&workspace.m_resized);
+			workspace.m_resized = cvCreateImage(cvSize(m_imagedim, m_imagedim), IPL_DEPTH_8U, view.channels);
+		}
+		// Note: the image header only refers to the pixels of the view, which
+		//       are resized in place without being copied
+		IplImage image;
+		cvInitImageHeader(&image, cvSize(view.width, view.height), IPL_DEPTH_8U, view.channels);
+		cvSetData(&image, (void *)view.data, view.step);
+		cvResize(&image, workspace.m_resized, CV_INTER_CUBIC);
+		IplImage *resized = workspace.m_resized;
+		Integral((const unsigned char *)resized->imageData, resized->width, resized->height, resized->widthStep, resized->nChannels, workspace.m_integral, view.rgb);
+	}
+	// Note: the determinant of hessian pyramid is only allocated once, since
+	//       the integral image always has the same size
+	workspace.m_fasthessian->setIntImage(workspace.m_integral);
 	return true;
 }
 
+void OpenSurf::ExtractPoints(OpenSurfWorkspace &workspace, double deadline, const OpenSurfInterestPoint *&points, int &ipoints)
+{
+	// extract interest points
+	// Note: the worker threads are only started the first time the workspace
+	//       is used, and then wait for the next image
+	if (m_threads > 1 && workspace.m_pool == NULL)
+		workspace.m_pool = NEW ThreadPool(m_threads);
+	int guaranteed = workspace.m_fasthessian->getIpoints(workspace.m_pool, deadline, m_enoughpoints);
+	// extract descriptors
+	DescribePoints(workspace, workspace.m_pool, deadline, guaranteed, points, ipoints);
+}
+
+void OpenSurf::DescribePoints(OpenSurfWorkspace &workspace, ThreadPool *pool, double deadline, int guaranteed, const OpenSurfInterestPoint *&points, int &ipoints)
+{
+	vector<OpenSurfInterestPoint> &ivector = workspace.m_points;
+	// only describe the points that fit within the budget
+	if (m_maxpoints > 0 && (int)ivector.size() > m_maxpoints)
+		SelectPoints(ivector, m_maxpoints, m_spread);
+	if (ivector.empty())
+	{
+		ipoints = 0;
+		points = NULL;
+		return;
+	}
+	HaarMaps *haarmaps = NULL;
+	if (m_haarmaps)
+	{
+		if (workspace.m_haarmaps == NULL)
+			workspace.m_haarmaps = NEW HaarMaps;
+		workspace.m_haarmaps->build(workspace.m_integral, ivector, m_parameters.upright);
+		haarmaps = workspace.m_haarmaps;
+	}
+	Surf des(workspace.m_integral, ivector, haarmaps);
+	des.getDescriptors(m_parameters.upright, pool, deadline, guaranteed);
+	// Note: with a deadline the points that were not described in time have
+	//       been removed, but the guaranteed number of points is always kept.
+	//       the selected points remain in the order in which they were detected,
+	//       so these are the first ones kept, starting at the coarsest octave
+	ipoints = (int)ivector.size();
+	points = ipoints > 0 ? &ivector[0] : NULL;
+}
+
 float OpenSurf::CompareDescriptors(const float *descriptor1, int ipoints1, const float *descriptor2, int ipoints2)
 {
 	// modified copy from getMatches function in ipoint.cpp
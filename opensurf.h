@@ -31,16 +31,154 @@
 #include "opencv/cv.h"
 #include "opencv/highgui.h"
 
+class FastHessian;
+class HaarMaps;
+class IntegralAreaStream;
+class ThreadPool;
+
+// parameters that determine how the interest points are detected and described
+struct OpenSurfParameters
+{
+	OpenSurfParameters();
+	bool operator==(const OpenSurfParameters &other) const;
+	bool operator!=(const OpenSurfParameters &other) const;
+	// number of octaves in which to search for interest points
+	int octaves;
+	// number of intervals per octave
+	int intervals;
+	// sampling step of the first octave
+	int init_sample;
+	// minimum determinant of hessian response of an interest point
+	float thres;
+	// describe the interest points without assigning them an orientation, i.e.
+	// extract upright descriptors that are not rotation invariant (U-SURF)
+	bool upright;
+};
+
+// view on the 8-bit pixels of an image in memory, which are read in place
+struct OpenSurfImageView
+{
+	OpenSurfImageView(const unsigned char *data, int width, int height, int step, int channels, bool rgb = false);
+	// top-left pixel
+	const unsigned char *data;
+	// dimensions of the image
+	int width;
+	int height;
+	// number of bytes from the start of one row to the start of the next
+	int step;
+	// number of channels, i.e. 1 for gray, 3 for BGR and 4 for BGRA pixels
+	int channels;
+	// color pixels are RGB or RGBA instead
+	bool rgb;
+};
+
+// buffers that are kept between extractions, so that extracting the descriptors
+// of many images does not need to allocate them again for every image
+// Note: a workspace may only be used by a single thread at a time
+class OpenSurfWorkspace
+{
+public:
+	OpenSurfWorkspace();
+	~OpenSurfWorkspace();
+
+private:
+	friend class OpenSurf;
+	// resized image, only used when the image is neither already of the
+	// right size nor large enough to be shrunk by area averaging
+	IplImage *m_resized;
+	// integral image
+	IplImage *m_integral;
+	// tables and rows used to shrink large images by area averaging
+	IntegralAreaStream *m_area;
+	// interest point detector, which holds the determinant of hessian pyramid
+	FastHessian *m_fasthessian;
+	// parameters the interest point detector was set up with
+	OpenSurfParameters m_parameters;
+	// detected interest points
+	vector<OpenSurfInterestPoint> m_points;
+	// interleaved integral images of a batch, only used by the first workspace
+	// of a batch
+	vector<float> m_interleaved;
+	// haar wavelet responses shared by the interest points, only used when
+	// enabled for the extraction
+	HaarMaps *m_haarmaps;
+	// worker threads that detect and describe the interest points, only used
+	// when more than one thread is requested for the extraction
+	ThreadPool *m_pool;
+};
+
 class OpenSurf
 {
 public:
-	OpenSurf(int imagedim);
+	// when haarmaps is set, the haar wavelet responses at each wavelet size used by
+	// the interest points are calculated once for the entire image, which pays off
+	// for images with many overlapping interest points
+	// when threads is larger than one, the interest points of an image are detected
+	// and described by that many threads at once, which lowers the time needed for a
+	// single image
+	OpenSurf(int imagedim, bool haarmaps = false, int threads = 1);
 	~OpenSurf();
 
 public:
+	// set the parameters of the detection and description of the interest points
+	void SetParameters(const OpenSurfParameters &parameters);
+	const OpenSurfParameters &GetParameters() const;
+	// limit the number of interest points that are described per image to the
+	// strongest maxpoints responses, or to no limit when maxpoints is zero. when
+	// spread is set, the points are selected by adaptive non-maximal suppression
+	// instead, which favors strong points that are spread across the image
+	void SetPointBudget(int maxpoints, bool spread = false);
+	// limit the time spent on detecting and describing the interest points of an
+	// image to the given number of milliseconds, or to no limit when zero. the
+	// octaves are then searched from coarse to fine, and the search stops once the
+	// time is up or once at least enoughpoints points were found (when non-zero).
+	// points that could not be described in time are left out, but the octaves
+	// are always searched until one with any points was found, and the points
+	// found up to then are always described (within the point budget)
+	// Note: the octave that is being searched when time is up is still finished,
+	//       so the limit is not exact
+	void SetTimeBudget(int milliseconds, int enoughpoints = 0);
+	// calculate the haar wavelet responses once for the entire image, as when
+	// haarmaps is given to the constructor
+	void SetHaarMaps(bool haarmaps);
+
+public:
+	// load an image from disk to extract the descriptor from, which is decoded to
+	// gray and reduced in size while decoding as far as the image dimension allows,
+	// or return NULL when it cannot be loaded
+	IplImage *LoadImage(const char *fname) const;
+	// decode an encoded jpeg or png image in memory in the same way as LoadImage,
+	// or return NULL when it cannot be decoded
+	IplImage *DecodeImage(const unsigned char *encoded, size_t length) const;
 	// extract descriptor
+	// Note: these allocate a new workspace for every call, so when extracting the
+	//       descriptors of many images use the overloads that take a workspace
 	bool ExtractDescriptor(IplImage &image, float *&descriptor, int &ipoints);
 	bool ExtractDescriptor(IplImage &image, OpenSurfInterestPoint *&points, int &ipoints);
+	// extract descriptor using the buffers of the workspace
+	// Note: the points are owned by the workspace and remain valid until the
+	//       workspace is used for the next extraction or is destroyed
+	bool ExtractDescriptor(IplImage &image, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints);
+	// extract descriptor from pixels in memory using the buffers of the workspace,
+	// without copying them first
+	bool ExtractDescriptor(const OpenSurfImageView &view, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints);
+	// extract descriptor from an image on disk using the buffers of the workspace.
+	// images that are shrunk by at least a factor of two are decoded one row at a
+	// time straight into the integral image, so only a single row of the image is
+	// ever kept in memory. other images are loaded with LoadImage. when loaded is
+	// given, it is cleared when the image could not be loaded, in which case no
+	// message is printed, so the caller can tell this apart from other failures
+	bool ExtractDescriptor(const char *fname, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints, bool *loaded = NULL);
+	// extract descriptor from an encoded image in memory in the same way
+	bool ExtractDescriptor(const unsigned char *encoded, size_t length, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints);
+	// extract the descriptors of a batch of images using the buffers of one workspace
+	// per image, which have to be distinct. the determinant of hessian responses of
+	// several images are calculated at once, which pays off when many images are
+	// extracted one after the other, e.g. when re-indexing a collection
+	// Note: the time budget does not apply to a batch
+	bool ExtractDescriptors(IplImage **images, int count, OpenSurfWorkspace **workspaces, const OpenSurfInterestPoint **points, int *ipoints);
+	// number of images of a batch whose responses are calculated at once
+	static int GetBatchSize();
 	// return 1 minus percentage of interest points that were matched
 	static float CompareDescriptors(const float *descriptor1, int ipoints1, const float *descriptor2, int ipoints2);
 	static float CompareDescriptors(const OpenSurfInterestPoint *points1, int ipoints1, const OpenSurfInterestPoint *points2, int ipoints2);
@@ -57,8 +195,30 @@ public:
 	static bool SaveDescriptor(const char *fname, const OpenSurfInterestPoint *points, int ipoints);
 	static bool SaveDescriptor(FILE *file, const OpenSurfInterestPoint *points, int ipoints);
 
+private:
+	// allocate the buffers of the workspace, or check them when already allocated
+	bool SetupWorkspace(OpenSurfWorkspace &workspace);
+	// check the image and create its integral image in the workspace
+	bool PrepareWorkspace(IplImage &image, OpenSurfWorkspace &workspace);
+	bool PrepareWorkspace(const OpenSurfImageView &view, OpenSurfWorkspace &workspace);
+	// finish the extraction of an image that was streamed into the integral image of
+	// the workspace, or that was loaded entirely when given, which is then released
+	bool FinishExtraction(IplImage *image, OpenSurfWorkspace &workspace, const OpenSurfInterestPoint *&points, int &ipoints);
+	// detect and describe the interest points in the integral image of the workspace
+	void ExtractPoints(OpenSurfWorkspace &workspace, double deadline, const OpenSurfInterestPoint *&points, int &ipoints);
+	// describe the interest points that were detected in the workspace, where the
+	// first guaranteed points are described even when the deadline has passed
+	void DescribePoints(OpenSurfWorkspace &workspace, ThreadPool *pool, double deadline, int guaranteed, const OpenSurfInterestPoint *&points, int &ipoints);
+
 private:
 	int m_imagedim;
+	OpenSurfParameters m_parameters;
+	bool m_haarmaps;
+	int m_threads;
+	int m_maxpoints;
+	bool m_spread;
+	int m_timebudget;
+	int m_enoughpoints;
 };
 
 #endif
@@ -9,6 +9,7 @@
 ************************************************************/
 
 #include "surf.h"
+#include "threadpool.h"
 
 //! Round float to nearest integer
 inline int fRound(float flt)
@@ -44,6 +45,116 @@ const double gauss33 [11][11] = {
 	0.000148179,0.000141529,0.000123318,9.80224E-05,7.10796E-05,4.70202E-05,2.83755E-05,1.56215E-05,7.84553E-06,3.59452E-06,1.50238E-06
 };
 
+//-------------------------------------------------------
+//! Orientation priors, which are likewise worked out only once
+
+//! Offset and gaussian weight of a sample within radius 6 around an interest
+//! point, used to determine its orientation
+struct OrientationSample
+{
+	int i, j;
+	float gauss;
+};
+
+//! Number of samples used to determine the orientation
+static const int ORIENTATION_SAMPLES = 109;
+
+//! Number of pi/3 windows that slide around an interest point
+static const int ORIENTATION_WINDOWS = 42;
+
+static OrientationSample orientation_samples[ORIENTATION_SAMPLES];
+static float window_start[ORIENTATION_WINDOWS];
+static float window_end[ORIENTATION_WINDOWS];
+
+static int initOrientation()
+{
+	const int id[] = {6,5,4,3,2,1,0,1,2,3,4,5,6};
+
+	// samples within radius of 6
+	int idx = 0;
+	for(int i = -6; i <= 6; ++i) 
+	{
+		for(int j = -6; j <= 6; ++j) 
+		{
+			if(i*i + j*j < 36) 
+			{
+				orientation_samples[idx].i = i;
+				orientation_samples[idx].j = j;
+				orientation_samples[idx].gauss = static_cast<float>(gauss25[id[i+6]][id[j+6]]);
+				++idx;
+			}
+		}
+	}
+
+	// pi/3 windows around the feature point, with the start and end angles
+	// calculated in exactly the same way as they used to be in the loop
+	int w = 0;
+	for(float ang1 = 0; ang1 < 2*pi && w < ORIENTATION_WINDOWS; ang1+=0.15f, ++w) 
+	{
+		window_start[w] = ang1;
+		window_end[w] = ( ang1+pi/3.0f > 2*pi ? ang1-5.0f*pi/3.0f : ang1+pi/3.0f);
+	}
+	assert(idx == ORIENTATION_SAMPLES && w == ORIENTATION_WINDOWS);
+	return idx;
+}
+
+static const int orientation_init = initOrientation();
+
+//! Haar response of a sample and the angle it makes with the x-axis
+struct OrientationResponse
+{
+	float ang, x, y;
+
+	bool operator<(const OrientationResponse &other) const
+	{
+		return ang < other.ang;
+	}
+};
+
+//! Sum the responses whose angle lies strictly between ang1 and ang2, given
+//! the angles of the responses in increasing order
+static inline void sumWindow(const float *ang, const float *resX, const float *resY, int count, 
+							 float ang1, float ang2, float &sumX, float &sumY)
+{
+	int k = (int)(std::upper_bound(ang, ang + count, ang1) - ang);
+	const int end = (int)(std::lower_bound(ang, ang + count, ang2) - ang);
+	for(; k < end; ++k) 
+	{
+		sumX += resX[k];
+		sumY += resY[k];
+	}
+}
+
+//-------------------------------------------------------
+//! Descriptor priors
+
+//! Number of samples in a subregion of the descriptor
+static const int SUBREGION_SAMPLES = 81;
+
+//! Maximum number of gaussian weights by distance along one axis, beyond 
+//! which the weights of the samples are calculated one by one
+static const int GAUSS_WEIGHTS = 256;
+
+//! Gaussian weights of the 4x4 subregions of the descriptor
+static float subregion_gauss[4][4];
+
+static int initDescriptor()
+{
+	// calculated in exactly the same way as they used to be in the loop
+	const float sig = 1.5f;
+	for(int i = 0; i < 4; ++i) 
+	{
+		for(int j = 0; j < 4; ++j) 
+		{
+			float x = i+0.5f-2.0f, y = j+0.5f-2.0f;
+			subregion_gauss[i][j] = 1.0f/(2.0f*pi*sig*sig) * exp( -(x*x+y*y)/(2.0f*sig*sig));
+		}
+	}
+	return 4*4;
+}
+
+static const int descriptor_init = initDescriptor();
+
 //-------------------------------------------------------
 
 //! Destructor
@@ -54,16 +165,34 @@ Surf::~Surf()
 //-------------------------------------------------------
 
 //! Constructor
-Surf::Surf(IplImage *img, IpVec &ipts)
-: ipts(ipts)
+Surf::Surf(IplImage *img, IpVec &ipts, const HaarMaps *maps)
+: ipts(ipts), maps(maps), deadline(0), guaranteed(0)
 {
 	this->img = img;
 }
 
 //-------------------------------------------------------
 
+//! Describes a range of the interest points of a Surf object
+class SurfTask : public ThreadTask
+{
+public:
+	SurfTask(Surf &surf, bool upright) : surf(surf), upright(upright) {}
+
+	void Execute(int begin, int end)
+	{
+		surf.describe(begin, end, upright);
+	}
+
+private:
+	Surf &surf;
+	bool upright;
+};
+
+//-------------------------------------------------------
+
 //! Describe all features in the supplied vector
-void Surf::getDescriptors(bool upright)
+void Surf::getDescriptors(bool upright, ThreadPool *pool, double deadline, int guaranteed)
 {
 	// Check there are Ipoints to be described
 	if (!ipts.size()) return;
@@ -71,29 +200,62 @@ void Surf::getDescriptors(bool upright)
 	// Get the size of the vector for fixed loop bounds
 	int ipts_size = (int)ipts.size();
 
-	if (upright)
+	this->deadline = deadline;
+	this->guaranteed = guaranteed;
+	if (deadline > 0)
+		described.assign(ipts_size, 0);
+
+	// Each OpenSurfInterestPoint only depends on the integral image, so they
+	// can be described by several threads at once
+	if (pool && pool->GetThreadCount() > 1)
 	{
-		// U-SURF loop just gets descriptors
+		SurfTask task(*this, upright);
+		pool->Run(task, ipts_size);
+	}
+	else
+		describe(0, ipts_size, upright);
+
+	// Remove the Ipoints that were not described in time
+	if (deadline > 0)
+	{
+		int kept = 0;
 		for (int i = 0; i < ipts_size; ++i)
 		{
-			// Set the OpenSurfInterestPoint to be described
-			index = i;
-
-			// Extract upright (i.e. not rotation invariant) descriptors
-			getDescriptor(true);
+			if (described[i])
+				ipts[kept++] = ipts[i];
 		}
+		ipts.resize(kept);
 	}
-	else
+}
+
+//-------------------------------------------------------
+
+//! Describe the features from begin up to but not including end
+void Surf::describe(int begin, int end, bool upright)
+{
+	for (int i = begin; i < end; ++i)
 	{
-		// Main SURF-64 loop assigns orientations and gets descriptors
-		for (int i = 0; i < ipts_size; ++i)
+		// Once the deadline has passed the remaining Ipoints are skipped,
+		// apart from the guaranteed ones
+		if (deadline > 0)
 		{
-			// Set the OpenSurfInterestPoint to be described
-			index = i;
+			if (i >= guaranteed && GetMonotonicTime() >= deadline)
+				return;
+			described[i] = 1;
+		}
 
-			// Assign Orientations and extract rotation invariant descriptors
-			getOrientation();
-			getDescriptor(false);
+		if (upright)
+		{
+			// U-SURF just gets descriptors, which are upright (i.e. not
+			// rotation invariant)
+			getDescriptor(i, true);
+		}
+		else
+		{
+			// Main SURF-64 assigns orientations and extracts rotation 
+			// invariant descriptors
+			getOrientation(i);
+			getDescriptor(i, false);
 		}
 	}
 }
@@ -101,57 +263,75 @@ void Surf::getDescriptors(bool upright)
 //-------------------------------------------------------
 
 //! Assign the supplied OpenSurfInterestPoint an orientation
-void Surf::getOrientation()
+void Surf::getOrientation(int index)
 {
 	OpenSurfInterestPoint *ipt = &ipts[index];
-	float gauss = 0.f, scale = ipt->scale;
+	const float scale = ipt->scale;
 	const int s = fRound(scale), r = fRound(ipt->y), c = fRound(ipt->x);
-	std::vector<float> resX(109), resY(109), Ang(109);
-	const int id[] = {6,5,4,3,2,1,0,1,2,3,4,5,6};
+	OrientationResponse res[ORIENTATION_SAMPLES];
 
-	int idx = 0;
+	// precalculated responses, which only cover the samples within the image
+	const float *mapX = maps ? maps->getX(4*s) : NULL;
+	const float *mapY = maps ? maps->getY(4*s) : NULL;
+
+	int count = 0;
 	// calculate haar responses for points within radius of 6*scale
-	for(int i = -6; i <= 6; ++i) 
+	for(int k = 0; k < ORIENTATION_SAMPLES; ++k) 
 	{
-		for(int j = -6; j <= 6; ++j) 
+		const OrientationSample &sample = orientation_samples[k];
+		const int row = r+sample.j*s, col = c+sample.i*s;
+		float resX, resY;
+		if (mapX && row >= 0 && row < img->height && col >= 0 && col < img->width)
 		{
-			if(i*i + j*j < 36) 
-			{
-				gauss = static_cast<float>(gauss25[id[i+6]][id[j+6]]);
-				resX[idx] = gauss * haarX(r+j*s, c+i*s, 4*s);
-				resY[idx] = gauss * haarY(r+j*s, c+i*s, 4*s);
-				Ang[idx] = getAngle(resX[idx], resY[idx]);
-				++idx;
-			}
+			resX = sample.gauss * mapX[row*img->width + col];
+			resY = sample.gauss * mapY[row*img->width + col];
+		}
+		else
+		{
+			resX = sample.gauss * haarX(row, col, 4*s);
+			resY = sample.gauss * haarY(row, col, 4*s);
 		}
+
+		// samples without any response never add anything to a window
+		if (resX == 0 && resY == 0)
+			continue;
+
+		res[count].ang = getAngle(resX, resY);
+		res[count].x = resX;
+		res[count].y = resY;
+		++count;
+	}
+
+	// order the responses by their angle, so the responses within each
+	// window are found by a binary search and lie next to each other
+	std::sort(res, res + count);
+	float Ang[ORIENTATION_SAMPLES], resX[ORIENTATION_SAMPLES], resY[ORIENTATION_SAMPLES];
+	for(int k = 0; k < count; ++k) 
+	{
+		Ang[k] = res[k].ang;
+		resX[k] = res[k].x;
+		resY[k] = res[k].y;
 	}
 
 	// calculate the dominant direction 
 	float sumX=0.f, sumY=0.f;
 	float max=0.f, orientation = 0.f;
-	float ang1=0.f, ang2=0.f;
 
 	// loop slides pi/3 window around feature point
-	for(ang1 = 0; ang1 < 2*pi;  ang1+=0.15f) {
-		ang2 = ( ang1+pi/3.0f > 2*pi ? ang1-5.0f*pi/3.0f : ang1+pi/3.0f);
+	for(int w = 0; w < ORIENTATION_WINDOWS; ++w) 
+	{
+		const float ang1 = window_start[w];
+		const float ang2 = window_end[w];
 		sumX = sumY = 0.f; 
-		for(unsigned int k = 0; k < Ang.size(); ++k) 
-		{
-			// get angle from the x-axis of the sample point
-			const float & ang = Ang[k];
 
-			// determine whether the point is within the window
-			if (ang1 < ang2 && ang1 < ang && ang < ang2) 
-			{
-				sumX+=resX[k];  
-				sumY+=resY[k];
-			} 
-			else if (ang2 < ang1 && 
-				((ang > 0 && ang < ang2) || (ang > ang1 && ang < 2*pi) )) 
-			{
-				sumX+=resX[k];  
-				sumY+=resY[k];
-			}
+		// determine which points are within the window
+		if (ang1 < ang2) 
+			sumWindow(Ang, resX, resY, count, ang1, ang2, sumX, sumY);
+		else if (ang2 < ang1) 
+		{
+			// the window wraps around the x-axis
+			sumWindow(Ang, resX, resY, count, 0, ang2, sumX, sumY);
+			sumWindow(Ang, resX, resY, count, ang1, 2*pi, sumX, sumY);
 		}
 
 		// if the vector produced from this window is longer than all 
@@ -172,14 +352,14 @@ void Surf::getOrientation()
 
 //! Get the modified descriptor. See Agrawal ECCV 08
 //! Modified descriptor contributed by Pablo Fernandez
-void Surf::getDescriptor(bool bUpright)
+void Surf::getDescriptor(int index, bool bUpright)
 {
 	int y, x, sample_x, sample_y, count=0;
-	int i = 0, ix = 0, j = 0, jx = 0, xs = 0, ys = 0;
+	int i = 0, ix = 0, j = 0, jx = 0, xs = 0, ys = 0, n = 0;
 	float scale, *desc, dx, dy, mdx, mdy, co, si;
 	float gauss_s1 = 0.f, gauss_s2 = 0.f;
 	float rx = 0.f, ry = 0.f, rrx = 0.f, rry = 0.f, len = 0.f;
-	float cx = -0.5f, cy = 0.f; //Subregion centers for the 4x4 gaussian weighting
+	int cx = -1, cy = 0; //Subregion indices for the 4x4 gaussian weighting
 
 	OpenSurfInterestPoint *ipt = &ipts[index];
 	scale = ipt->scale;
@@ -198,6 +378,41 @@ void Surf::getDescriptor(bool bUpright)
 		si = sin(ipt->orientation);
 	}
 
+	// the rotated offsets of the samples, which are calculated in exactly the
+	// same way as they used to be for every sample
+	float tco[24], tsi[24];
+	for (int v = -12; v < 12; ++v)
+	{
+		tco[v+12] = v*scale*co;
+		tsi[v+12] = v*scale*si;
+	}
+
+	// the gaussian with sigma 2.5*scale is separable, so only its weights by
+	// the distance along a single axis need to be calculated
+	const float sig = 2.5f*scale;
+	const float norm = 1.0f/(2.0f*pi*sig*sig);
+	const int weights = std::min((int)(6.0f*scale) + 2, GAUSS_WEIGHTS);
+	float gauss_weights[GAUSS_WEIGHTS];
+	for (int d = 0; d < weights; ++d)
+		gauss_weights[d] = exp( -(d*d)/(2.0f*sig*sig));
+
+	// the boxes of the haar wavelets relative to the sample
+	const float *data = (const float *) img->imageData;
+	const int step = img->widthStep/sizeof(float);
+	const int s = 2*fRound(scale), h = s/2;
+	BoxCorners right, left, bottom, top;
+	right.set(-h, 0, s, h, step);
+	left.set(-h, -h, s, h, step);
+	bottom.set(0, -h, h, s, step);
+	top.set(-h, -h, h, s, step);
+
+	// precalculated responses, which only cover the samples within the image
+	const float *mapX = maps ? maps->getX(s) : NULL;
+	const float *mapY = maps ? maps->getY(s) : NULL;
+
+	int rows[SUBREGION_SAMPLES], cols[SUBREGION_SAMPLES];
+	float gauss[SUBREGION_SAMPLES], resx[SUBREGION_SAMPLES], resy[SUBREGION_SAMPLES];
+
 	i = -8;
 
 	//Calculate descriptor for this interest point
@@ -206,49 +421,109 @@ void Surf::getDescriptor(bool bUpright)
 		j = -8;
 		i = i-4;
 
-		cx += 1.f;
-		cy = -0.5f;
+		cx += 1;
+		cy = -1;
 
 		while(j < 12) 
 		{
 			dx=dy=mdx=mdy=0.f;
-			cy += 1.f;
+			cy += 1;
 
 			j = j - 4;
 
 			ix = i + 5;
 			jx = j + 5;
 
-			xs = fRound(x + ( -jx*scale*si + ix*scale*co));
-			ys = fRound(y + ( jx*scale*co + ix*scale*si));
+			xs = fRound(x + ( -tsi[jx+12] + tco[ix+12]));
+			ys = fRound(y + ( tco[jx+12] + tsi[ix+12]));
 
+			// gather the coordinates and gaussian weights of the samples
+			n = 0;
 			for (int k = i; k < i + 9; ++k) 
 			{
-				for (int l = j; l < j + 9; ++l) 
+				for (int l = j; l < j + 9; ++l, ++n) 
 				{
 					//Get coords of sample point on the rotated axis
-					sample_x = fRound(x + (-l*scale*si + k*scale*co));
-					sample_y = fRound(y + ( l*scale*co + k*scale*si));
-
-					//Get the gaussian weighted x and y responses
-					gauss_s1 = gaussian(xs-sample_x,ys-sample_y,2.5f*scale);
-					rx = haarX(sample_y, sample_x, 2*fRound(scale));
-					ry = haarY(sample_y, sample_x, 2*fRound(scale));
-
-					//Get the gaussian weighted x and y responses on rotated axis
-					rrx = gauss_s1*(-rx*si + ry*co);
-					rry = gauss_s1*(rx*co + ry*si);
-
-					dx += rrx;
-					dy += rry;
-					mdx += fabs(rrx);
-					mdy += fabs(rry);
+					sample_x = fRound(x + (-tsi[l+12] + tco[k+12]));
+					sample_y = fRound(y + ( tco[l+12] + tsi[k+12]));
+					rows[n] = sample_y;
+					cols[n] = sample_x;
+
+					const int gx = abs(xs-sample_x), gy = abs(ys-sample_y);
+					if (gx < weights && gy < weights)
+						gauss[n] = norm * gauss_weights[gx] * gauss_weights[gy];
+					else
+						gauss[n] = gaussian(xs-sample_x,ys-sample_y,sig);
+				}
+			}
 
+			// look up the x and y responses of the samples when they have been
+			// precalculated, otherwise calculate them four at a time when none
+			// of their boxes lie across the border of the image
+			n = 0;
+			if (mapX)
+			{
+				for (; n < SUBREGION_SAMPLES; ++n)
+				{
+					if (rows[n] >= 0 && rows[n] < img->height && cols[n] >= 0 && cols[n] < img->width)
+					{
+						resx[n] = mapX[rows[n]*img->width + cols[n]];
+						resy[n] = mapY[rows[n]*img->width + cols[n]];
+					}
+					else
+					{
+						resx[n] = haarX(rows[n], cols[n], s);
+						resy[n] = haarY(rows[n], cols[n], s);
+					}
+				}
+			}
+#ifdef OPENSURF_SSE2
+			for (; n + 4 <= SUBREGION_SAMPLES; n += 4) 
+			{
+				const int *r = rows + n, *c = cols + n;
+				if (std::min(std::min(r[0], r[1]), std::min(r[2], r[3])) - h - 1 < 0 ||
+					std::min(std::min(c[0], c[1]), std::min(c[2], c[3])) - h - 1 < 0 ||
+					std::max(std::max(r[0], r[1]), std::max(r[2], r[3])) + h > img->height ||
+					std::max(std::max(c[0], c[1]), std::max(c[2], c[3])) + h > img->width)
+				{
+					for (int m = 0; m < 4; ++m)
+					{
+						resx[n+m] = haarX(r[m], c[m], s);
+						resy[n+m] = haarY(r[m], c[m], s);
+					}
+					continue;
 				}
+				const float *p0 = data + r[0]*step + c[0], *p1 = data + r[1]*step + c[1];
+				const float *p2 = data + r[2]*step + c[2], *p3 = data + r[3]*step + c[3];
+				_mm_storeu_ps(resx + n, _mm_sub_ps(right.sum4(p0, p1, p2, p3), left.sum4(p0, p1, p2, p3)));
+				_mm_storeu_ps(resy + n, _mm_sub_ps(bottom.sum4(p0, p1, p2, p3), top.sum4(p0, p1, p2, p3)));
+			}
+#endif
+			for (; n < SUBREGION_SAMPLES; ++n)
+			{
+				resx[n] = haarX(rows[n], cols[n], s);
+				resy[n] = haarY(rows[n], cols[n], s);
+			}
+
+			for (n = 0; n < SUBREGION_SAMPLES; ++n) 
+			{
+				//Get the gaussian weighted x and y responses
+				gauss_s1 = gauss[n];
+				rx = resx[n];
+				ry = resy[n];
+
+				//Get the gaussian weighted x and y responses on rotated axis
+				rrx = gauss_s1*(-rx*si + ry*co);
+				rry = gauss_s1*(rx*co + ry*si);
+
+				dx += rrx;
+				dy += rry;
+				mdx += fabs(rrx);
+				mdy += fabs(rry);
 			}
 
 			//Add the values to the descriptor vector
-			gauss_s2 = gaussian(cx-2.0f,cy-2.0f,1.5f);
+			gauss_s2 = subregion_gauss[cx][cy];
 
 			desc[count++] = dx*gauss_s2;
 			desc[count++] = dy*gauss_s2;
@@ -269,7 +544,6 @@ void Surf::getDescriptor(bool bUpright)
 
 }
 
-
 //-------------------------------------------------------
 
 //! Calculate the value of the 2d gaussian at x,y
@@ -322,4 +596,121 @@ float Surf::getAngle(float X, float Y)
 		return 2*pi - atan(-Y/X);
 
 	return 0;
-}
\ No newline at end of file
+}
+
+//-------------------------------------------------------
+
+//! Calculate the responses at the wavelet sizes used by the interest points
+void HaarMaps::build(IplImage *img, const IpVec &ipts, bool bUpright)
+{
+	const int pixels = img->width * img->height;
+
+	// count the samples at each wavelet size, where the descriptor uses 
+	// wavelets of twice the rounded scale and the orientation uses wavelets 
+	// of four times the rounded scale
+	std::fill(index.begin(), index.end(), 0);
+	for (size_t i = 0; i < ipts.size(); ++i)
+	{
+		const int s = fRound(ipts[i].scale);
+		if (4*s >= (int)index.size())
+			index.resize(4*s + 1, 0);
+		index[2*s] += 16*SUBREGION_SAMPLES;
+		if (!bUpright)
+			index[4*s] += ORIENTATION_SAMPLES;
+	}
+
+	// only calculate the maps of the sizes with at least as many samples as
+	// there are pixels, since otherwise the samples are cheaper on their own
+	int maps = 0;
+	for (int size = 0; size < (int)index.size(); ++size)
+	{
+		if (index[size] < pixels)
+		{
+			index[size] = -1;
+			continue;
+		}
+		if (maps == (int)x.size())
+		{
+			x.push_back(std::vector<float>());
+			y.push_back(std::vector<float>());
+		}
+		x[maps].resize(pixels);
+		y[maps].resize(pixels);
+		calculate(img, size, &x[maps][0], &y[maps][0]);
+		index[size] = maps++;
+	}
+}
+
+//-------------------------------------------------------
+
+//! Responses in x direction at the given wavelet size
+const float *HaarMaps::getX(int size) const
+{
+	if (size >= (int)index.size() || index[size] < 0)
+		return NULL;
+	return &x[index[size]][0];
+}
+
+//-------------------------------------------------------
+
+//! Responses in y direction at the given wavelet size
+const float *HaarMaps::getY(int size) const
+{
+	if (size >= (int)index.size() || index[size] < 0)
+		return NULL;
+	return &y[index[size]][0];
+}
+
+//-------------------------------------------------------
+
+//! Calculate the responses at a single wavelet size, in exactly the same way
+//! as Surf::haarX and Surf::haarY do
+void HaarMaps::calculate(IplImage *img, int s, float *x, float *y)
+{
+	const float *data = (const float *) img->imageData;
+	const int step = img->widthStep/sizeof(float);
+	const int width = img->width, height = img->height, h = s/2;
+	BoxCorners right, left, bottom, top;
+	right.set(-h, 0, s, h, step);
+	left.set(-h, -h, s, h, step);
+	bottom.set(0, -h, h, s, step);
+	top.set(-h, -h, h, s, step);
+
+	for (int r = 0; r < height; ++r, x += width, y += width)
+	{
+		const float *p = data + r*step;
+
+		// the boxes only lie within the image for the columns away from
+		// its border
+		int start = width, end = width;
+		if (r-h-1 >= 0 && r+h <= height && h+1 < width-h+1)
+		{
+			start = h+1;
+			end = width-h+1;
+		}
+
+		int c = 0;
+		for (; c < start; ++c)
+		{
+			x[c] = BoxIntegral(img, r-s/2, c, s, s/2) - BoxIntegral(img, r-s/2, c-s/2, s, s/2);
+			y[c] = BoxIntegral(img, r, c-s/2, s/2, s) - BoxIntegral(img, r-s/2, c-s/2, s/2, s);
+		}
+#ifdef OPENSURF_SSE2
+		for (; c + 4 <= end; c += 4)
+		{
+			_mm_storeu_ps(x + c, _mm_sub_ps(right.sum4(p + c, 1), left.sum4(p + c, 1)));
+			_mm_storeu_ps(y + c, _mm_sub_ps(bottom.sum4(p + c, 1), top.sum4(p + c, 1)));
+		}
+#endif
+		for (; c < end; ++c)
+		{
+			x[c] = right.sum(p + c) - left.sum(p + c);
+			y[c] = bottom.sum(p + c) - top.sum(p + c);
+		}
+		for (; c < width; ++c)
+		{
+			x[c] = BoxIntegral(img, r-s/2, c, s, s/2) - BoxIntegral(img, r-s/2, c-s/2, s, s/2);
+			y[c] = BoxIntegral(img, r, c-s/2, s/2, s) - BoxIntegral(img, r-s/2, c-s/2, s/2, s);
+		}
+	}
+}
@@ -17,6 +17,36 @@
 
 #include <vector>
 
+class ThreadPool;
+
+//! Dense Haar wavelet responses of an integral image for each wavelet size
+//! used by a set of interest points, so that overlapping interest points of
+//! similar scale look their responses up instead of calculating them again.
+//! The buffers are kept between images.
+class HaarMaps {
+
+public:
+
+	//! Calculate the responses at the wavelet sizes used by the interest points
+	void build(IplImage *img, const std::vector<OpenSurfInterestPoint> &ipts, bool bUpright);
+
+	//! Responses in x and y direction at the given wavelet size, or NULL if
+	//! they were not calculated
+	const float *getX(int size) const;
+	const float *getY(int size) const;
+
+private:
+
+	//! Calculate the responses at a single wavelet size
+	void calculate(IplImage *img, int size, float *x, float *y);
+
+	//! Map number of each wavelet size, or -1 when not calculated
+	std::vector<int> index;
+
+	//! Responses in x and y direction of the maps, one after the other
+	std::vector< std::vector<float> > x, y;
+};
+
 class Surf {
 
 public:
@@ -24,21 +54,30 @@ public:
 	//! Destructor
 	~Surf();
 
-	//! Standard Constructor (img is an integral image)
-	Surf(IplImage *img, std::vector<OpenSurfInterestPoint> &ipts);
+	//! Standard Constructor (img is an integral image, maps are optional
+	//! precalculated responses of the same image)
+	Surf(IplImage *img, std::vector<OpenSurfInterestPoint> &ipts, const HaarMaps *maps = NULL);
 
-	//! Describe all features in the supplied vector
-	void getDescriptors(bool bUpright = false);
+	//! Describe all features in the supplied vector, split across the threads
+	//! of the pool if one is given. With a deadline (see GetMonotonicTime) the
+	//! features that were not described in time are removed from the vector,
+	//! except for the first guaranteed features, which are always described
+	void getDescriptors(bool bUpright = false, ThreadPool *pool = NULL, double deadline = 0, int guaranteed = 0);
 
 private:
 
+	friend class SurfTask;
+
 	//---------------- Private Functions -----------------//
 
-	//! Assign the current OpenSurfInterestPoint an orientation
-	void getOrientation();
+	//! Describe the features from begin up to but not including end
+	void describe(int begin, int end, bool bUpright);
+
+	//! Assign the OpenSurfInterestPoint at the index an orientation
+	void getOrientation(int index);
 
 	//! Get the descriptor. See Agrawal ECCV 08
-	void getDescriptor(bool bUpright = false);
+	void getDescriptor(int index, bool bUpright = false);
 
 	//! Calculate the value of the 2d gaussian at x,y
 	inline float gaussian(int x, int y, float sig);
@@ -60,8 +99,17 @@ private:
 	//! Ipoints vector
 	IpVec &ipts;
 
-	//! Index of current OpenSurfInterestPoint in the vector
-	int index;
+	//! Precalculated Haar wavelet responses, if any
+	const HaarMaps *maps;
+
+	//! Time at which to stop describing, or zero when there is none
+	double deadline;
+
+	//! Number of features that are described regardless of the deadline
+	int guaranteed;
+
+	//! Whether each OpenSurfInterestPoint was described, only with a deadline
+	std::vector<unsigned char> described;
 };
 
 
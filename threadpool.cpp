@@ -0,0 +1,201 @@
+/*	TOP-SURF: a visual words toolkit
+	Copyright (C) 2010 LIACS Media Lab, Leiden University,
+	                   Bart Thomee (bthomee@liacs.nl),
+					   Erwin M. Bakker (erwin@liacs.nl)	and
+					   Michael S. Lew (mlew@liacs.nl).
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    See http://www.gnu.org/licenses/gpl.html for the full license.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+	In addition, this work is covered under the Creative Commons
+	Attribution license version 3.
+    See http://creativecommons.org/licenses/by/3.0/ for the full license.
+*/
+
+#include "threadpool.h"
+
+#if defined WIN32 || defined _WIN32 || defined WIN64 || defined _WIN64
+ThreadPool::ThreadPool(int threads)
+{
+	m_task = NULL;
+	m_count = m_next = m_chunk = m_active = 0;
+	m_stop = false;
+	InitializeMutex(m_mutex);
+	int workers = std::max(threads, 1) - 1;
+	m_start = CreateSemaphore(NULL, 0, std::max(workers, 1), NULL);
+	m_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	for (int i = 0; i < workers; i++)
+	{
+		HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, WorkerThread, this, 0, NULL);
+		if (thread == NULL)
+		{
+			SAFE_FLUSHPRINT(stderr, "could not start worker thread, continuing with %d\n", (int)m_threads.size() + 1);
+			break;
+		}
+		m_threads.push_back(thread);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	LockMutex(m_mutex);
+	m_stop = true;
+	UnlockMutex(m_mutex);
+	if (!m_threads.empty())
+		ReleaseSemaphore(m_start, (LONG)m_threads.size(), NULL);
+	for (size_t i = 0; i < m_threads.size(); i++)
+	{
+		WaitForSingleObject(m_threads[i], INFINITE);
+		CloseHandle(m_threads[i]);
+	}
+	CloseHandle(m_start);
+	CloseHandle(m_done);
+	DestroyMutex(m_mutex);
+}
+
+unsigned int __stdcall ThreadPool::WorkerThread(void *arg)
+{
+	ThreadPool *pool = (ThreadPool *)arg;
+	for (;;)
+	{
+		WaitForSingleObject(pool->m_start, INFINITE);
+		LockMutex(pool->m_mutex);
+		bool stop = pool->m_stop;
+		UnlockMutex(pool->m_mutex);
+		if (stop)
+			break;
+		pool->Work();
+		LockMutex(pool->m_mutex);
+		if (--pool->m_active == 0)
+			SetEvent(pool->m_done);
+		UnlockMutex(pool->m_mutex);
+	}
+	return 0;
+}
+#else
+ThreadPool::ThreadPool(int threads)
+{
+	m_task = NULL;
+	m_count = m_next = m_chunk = m_active = 0;
+	m_stop = false;
+	m_generation = 0;
+	InitializeMutex(m_mutex);
+	pthread_cond_init(&m_start, NULL);
+	pthread_cond_init(&m_done, NULL);
+	int workers = std::max(threads, 1) - 1;
+	for (int i = 0; i < workers; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, WorkerThread, this) != 0)
+		{
+			SAFE_FLUSHPRINT(stderr, "could not start worker thread, continuing with %d\n", (int)m_threads.size() + 1);
+			break;
+		}
+		m_threads.push_back(thread);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	LockMutex(m_mutex);
+	m_stop = true;
+	pthread_cond_broadcast(&m_start);
+	UnlockMutex(m_mutex);
+	for (size_t i = 0; i < m_threads.size(); i++)
+		pthread_join(m_threads[i], NULL);
+	pthread_cond_destroy(&m_start);
+	pthread_cond_destroy(&m_done);
+	DestroyMutex(m_mutex);
+}
+
+void *ThreadPool::WorkerThread(void *arg)
+{
+	ThreadPool *pool = (ThreadPool *)arg;
+	// Note: the pool may already have started a task before this thread got
+	//       to run, so we compare against the generation the pool started with
+	int generation = 0;
+	LockMutex(pool->m_mutex);
+	for (;;)
+	{
+		// wait until a new task starts or the pool is destroyed
+		while (pool->m_generation == generation && !pool->m_stop)
+			pthread_cond_wait(&pool->m_start, &pool->m_mutex);
+		if (pool->m_stop)
+			break;
+		generation = pool->m_generation;
+		UnlockMutex(pool->m_mutex);
+		pool->Work();
+		LockMutex(pool->m_mutex);
+		if (--pool->m_active == 0)
+			pthread_cond_signal(&pool->m_done);
+	}
+	UnlockMutex(pool->m_mutex);
+	return NULL;
+}
+#endif
+
+void ThreadPool::Run(ThreadTask &task, int count)
+{
+	if (count <= 0)
+		return;
+	// without any workers, or with only a single item, there is nothing to split
+	if (m_threads.empty() || count == 1)
+	{
+		task.Execute(0, count);
+		return;
+	}
+	// hand out the items in ranges that are small enough to keep all threads
+	// busy when some items take longer than others
+	LockMutex(m_mutex);
+	m_task = &task;
+	m_count = count;
+	m_next = 0;
+	m_chunk = std::max(count / (GetThreadCount() * 8), 1);
+	m_active = (int)m_threads.size();
+#if defined WIN32 || defined _WIN32 || defined WIN64 || defined _WIN64
+	UnlockMutex(m_mutex);
+	ReleaseSemaphore(m_start, (LONG)m_threads.size(), NULL);
+	Work();
+	WaitForSingleObject(m_done, INFINITE);
+	LockMutex(m_mutex);
+#else
+	m_generation++;
+	pthread_cond_broadcast(&m_start);
+	UnlockMutex(m_mutex);
+	Work();
+	LockMutex(m_mutex);
+	while (m_active > 0)
+		pthread_cond_wait(&m_done, &m_mutex);
+#endif
+	m_task = NULL;
+	UnlockMutex(m_mutex);
+}
+
+int ThreadPool::GetThreadCount() const
+{
+	return (int)m_threads.size() + 1;
+}
+
+void ThreadPool::Work()
+{
+	for (;;)
+	{
+		LockMutex(m_mutex);
+		int begin = m_next;
+		int end = std::min(begin + m_chunk, m_count);
+		m_next = end;
+		ThreadTask *task = m_task;
+		UnlockMutex(m_mutex);
+		if (begin >= end)
+			break;
+		task->Execute(begin, end);
+	}
+}
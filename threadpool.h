@@ -0,0 +1,98 @@
+/*	TOP-SURF: a visual words toolkit
+	Copyright (C) 2010 LIACS Media Lab, Leiden University,
+	                   Bart Thomee (bthomee@liacs.nl),
+					   Erwin M. Bakker (erwin@liacs.nl)	and
+					   Michael S. Lew (mlew@liacs.nl).
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    See http://www.gnu.org/licenses/gpl.html for the full license.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+	In addition, this work is covered under the Creative Commons
+	Attribution license version 3.
+    See http://creativecommons.org/licenses/by/3.0/ for the full license.
+*/
+
+#ifndef _THREADPOOLH
+#define _THREADPOOLH
+
+#pragma once
+
+#include "config.h"
+
+// a task that is split across the threads of a pool, where each thread
+// processes the items of the ranges it is handed
+class ThreadTask
+{
+public:
+	virtual ~ThreadTask() {}
+	// process the items from begin up to but not including end
+	virtual void Execute(int begin, int end) = 0;
+};
+
+// pool of worker threads that are started once and then wait for tasks, so
+// that a single task can be split across threads without the cost of
+// starting them every time
+// Note: a pool may only run a single task at a time, and the thread that
+//       runs it takes part in processing its items
+class ThreadPool
+{
+public:
+	// threads = total number of threads that process the items of a task,
+	//           including the calling thread
+	ThreadPool(int threads);
+	~ThreadPool();
+
+public:
+	// run the task on the items from 0 up to but not including count, and
+	// return once all items have been processed
+	void Run(ThreadTask &task, int count);
+	// return the total number of threads, including the calling thread
+	int GetThreadCount() const;
+
+private:
+	// process ranges of items of the current task until none are left
+	void Work();
+	// body of the worker threads
+#if defined WIN32 || defined _WIN32 || defined WIN64 || defined _WIN64
+	static unsigned int __stdcall WorkerThread(void *arg);
+#else
+	static void *WorkerThread(void *arg);
+#endif
+
+private:
+	// current task and its items
+	ThreadTask *m_task;
+	int m_count;
+	// next item to hand out and number of items in each range
+	int m_next;
+	int m_chunk;
+	// number of workers that have not finished the current task
+	int m_active;
+	// set when the workers should exit
+	bool m_stop;
+	// protects the state above
+	t_mutex m_mutex;
+#if defined WIN32 || defined _WIN32 || defined WIN64 || defined _WIN64
+	// released once for each worker when a task starts
+	HANDLE m_start;
+	// signaled when the last worker finished the task
+	HANDLE m_done;
+	vector<HANDLE> m_threads;
+#else
+	// incremented every time a task starts
+	int m_generation;
+	pthread_cond_t m_start;
+	pthread_cond_t m_done;
+	vector<pthread_t> m_threads;
+#endif
+};
+
+#endif
@@ -26,42 +26,110 @@
 
 #include "unistd.h"
 
-TopSurf::TopSurf(int imagedim, int top)
+// names of the presets as recorded with the dictionary, in the same order as
+// they are listed in TOPSURF_PRESET
+static const char *PRESET_NAMES[] = { "full", "upright", "fast", "fast-upright" };
+static const int PRESET_COUNT = sizeof(PRESET_NAMES) / sizeof(PRESET_NAMES[0]);
+
+// determine the number of channels of the pixels of the view and whether its
+// color pixels start with red, or return false when the view is invalid
+static bool GetPixelFormat(const TOPSURF_IMAGEVIEW &view, int &channels, bool &rgb)
+{
+	switch (view.format)
+	{
+	case TOPSURF_PIXEL_RGB:   channels = 3; rgb = true;  break;
+	case TOPSURF_PIXEL_BGR:   channels = 3; rgb = false; break;
+	case TOPSURF_PIXEL_RGBA:  channels = 4; rgb = true;  break;
+	case TOPSURF_PIXEL_BGRA:  channels = 4; rgb = false; break;
+	case TOPSURF_PIXEL_GRAY8: channels = 1; rgb = false; break;
+	default:
+		SAFE_FLUSHPRINT(stderr, "unknown pixel format\n");
+		return false;
+	}
+	if (view.pixels == NULL || view.width <= 0 || view.height <= 0 || view.stride < view.width * channels)
+	{
+		SAFE_FLUSHPRINT(stderr, "invalid image data provided\n");
+		return false;
+	}
+	return true;
+}
+
+TopSurf::TopSurf(int imagedim, int top, int threads, TOPSURF_PRESET preset)
 {
 	m_initialized = false;
 	m_imagedim = imagedim;
 	m_top = top;
-	m_opensurf = NEW OpenSurf(m_imagedim);
+	m_opensurf = NEW OpenSurf(m_imagedim, false, threads);
+	SetPreset(preset);
 	m_clusters = 0;
 	m_idf = NULL;
 	m_visualwords = NULL;
 	memset(&m_kdparam, 0, sizeof(FLANNParameters));
 	m_kdtree = NULL;
 	m_kddata = NULL;
-	m_weights = NULL;
+	InitializeMutex(m_workspacemutex);
 }
 
 TopSurf::~TopSurf()
 {
+	DestroyWorkspaces();
 	if (m_initialized)
 	{
 		delete[] m_visualwords;
 		delete[] m_idf;
 		delete m_kdtree;
 		delete m_kddata;
-		delete[] m_weights;
 	}
 	delete m_opensurf;
+	DestroyMutex(m_workspacemutex);
+}
+
+void TopSurf::SetPointBudget(int maxpoints, bool spread)
+{
+	m_opensurf->SetPointBudget(maxpoints, spread);
+}
+
+void TopSurf::SetTimeBudget(int milliseconds, int enoughpoints)
+{
+	m_opensurf->SetTimeBudget(milliseconds, enoughpoints);
+}
+
+void TopSurf::SetHaarMaps(bool haarmaps)
+{
+	m_opensurf->SetHaarMaps(haarmaps);
+}
+
+void TopSurf::SetPreset(TOPSURF_PRESET preset)
+{
+	OpenSurfParameters parameters;
+	switch (preset)
+	{
+	case TOPSURF_PRESET_UPRIGHT:
+		parameters.upright = true;
+		break;
+	case TOPSURF_PRESET_FAST:
+		parameters.octaves = 3;
+		break;
+	case TOPSURF_PRESET_FAST_UPRIGHT:
+		parameters.octaves = 3;
+		parameters.upright = true;
+		break;
+	default:
+		preset = TOPSURF_PRESET_FULL;
+		break;
+	}
+	m_preset = preset;
+	m_opensurf->SetParameters(parameters);
 }
 
 bool TopSurf::LoadDictionary(const char *dictionarydir)
 {
 	// release any old resources
+	DestroyWorkspaces();
 	SAFE_DELETE_ARRAY(m_idf);
 	SAFE_DELETE_ARRAY(m_visualwords);
 	SAFE_DELETE(m_kdtree);
 	SAFE_DELETE(m_kddata);
-	SAFE_DELETE_ARRAY(m_weights);
 	m_initialized = false;
 	// check parameter
 	if (dictionarydir == NULL)
@@ -73,11 +141,25 @@ bool TopSurf::LoadDictionary(const char *dictionarydir)
 	string dictdir = dictionarydir;
 	if (!dictdir.empty() && dictdir[dictdir.size()-1] != PATH_SEPARATOR_CHAR)
 		dictdir += PATH_SEPARATOR_STRING;
-	// load the size of the dictionary
+	// load the size of the dictionary and the preset it was created with
+	// Note: dictionaries that were created before presets existed were created
+	//       with what is now the full preset
 	char fname[MAX_PATH];
 	SAFE_SPRINTF(fname, sizeof(fname), "%s%s", dictdir.c_str(), "dictionary.txt");
-	if (!Dictionary::LoadSize(fname, m_clusters))
+	string presetname;
+	if (!Dictionary::LoadSize(fname, m_clusters, presetname))
 		return false;
+	int preset = presetname.empty() ? TOPSURF_PRESET_FULL : 0;
+	for (; !presetname.empty() && preset < PRESET_COUNT; preset++)
+	{
+		if (presetname == PRESET_NAMES[preset])
+			break;
+	}
+	if (preset == PRESET_COUNT)
+	{
+		SAFE_FLUSHPRINT(stderr, "unknown extraction preset %s in %s\n", presetname.c_str(), fname);
+		return false;
+	}
 	// load idf weights
 	SAFE_SPRINTF(fname, sizeof(fname), "%s%s", dictdir.c_str(), "idf.dat");
 	if (!Dictionary::LoadIDF(fname, m_clusters, m_idf))
@@ -98,8 +180,8 @@ bool TopSurf::LoadDictionary(const char *dictionarydir)
 		delete[] m_idf;
 		return false;
 	}
-	// setup visual word weights to use during extraction
-	m_weights = NEW TOPSURF_ELEMENT[m_clusters];
+	// extract the descriptors in the same way as the dictionary was created
+	SetPreset((TOPSURF_PRESET)preset);
 	m_initialized = true;
 	return true;
 }
@@ -130,7 +212,7 @@ bool TopSurf::SaveDictionary(const char *dictionarydir)
 	// save the size of the dictionary
 	char fname[MAX_PATH];
 	SAFE_SPRINTF(fname, sizeof(fname), "%s%s", dictdir.c_str(), "dictionary.txt");
-	if (!Dictionary::SaveSize(fname, m_clusters))
+	if (!Dictionary::SaveSize(fname, m_clusters, PRESET_NAMES[m_preset]))
 		return false;
 	// save idf weights
 	SAFE_SPRINTF(fname, sizeof(fname), "%s%s", dictdir.c_str(), "idf.dat");
@@ -150,116 +232,304 @@ bool TopSurf::SaveDictionary(const char *dictionarydir)
 bool TopSurf::CreateDictionary(const char *imagedir, int clusters, int knn, int iterations, int points)
 {
 	// release any old resources
+	DestroyWorkspaces();
 	SAFE_DELETE_ARRAY(m_idf);
 	SAFE_DELETE_ARRAY(m_visualwords);
 	SAFE_DELETE(m_kdtree);
 	SAFE_DELETE(m_kddata);
-	SAFE_DELETE_ARRAY(m_weights);
 	m_clusters = 0;
 	m_initialized = false;
 	// create a new dictionary
-	if (!Dictionary::Create(imagedir, m_imagedim, clusters, knn, iterations, points, m_idf, m_visualwords, m_kdtree, m_kddata, m_kdparam))
+	if (!Dictionary::Create(imagedir, m_imagedim, m_opensurf->GetParameters(), clusters, knn, iterations, points, m_idf, m_visualwords, m_kdtree, m_kddata, m_kdparam))
 		return false;
 	// set the number of clusters
 	m_clusters = clusters;
-	// setup visual word weights to use during extraction
-	m_weights = NEW TOPSURF_ELEMENT[clusters];
 	m_initialized = true;
 	return true;
 }
 
+IplImage *TopSurf::LoadImage(const char *fname) const
+{
+	return m_opensurf->LoadImage(fname);
+}
+
 bool TopSurf::ExtractDescriptor(IplImage &image, TOPSURF_DESCRIPTOR &descriptor)
+{
+	if (!m_initialized)
+		return false;
+	// extract the descriptor using a workspace that no other thread is using
+	TOPSURF_WORKSPACE *workspace = AcquireWorkspace();
+	bool success = ExtractDescriptor(image, descriptor, *workspace);
+	ReleaseWorkspace(workspace);
+	return success;
+}
+
+bool TopSurf::ExtractDescriptor(const char *fname, TOPSURF_DESCRIPTOR &descriptor)
+{
+	if (!m_initialized)
+		return false;
+	// prepare the descriptor
+	descriptor.count = 0;
+	descriptor.visualword = NULL;
+	// extract the interest points using a workspace that no other thread is using
+	TOPSURF_WORKSPACE *workspace = AcquireWorkspace();
+	const OpenSurfInterestPoint *points;
+	int ip;
+	bool success = m_opensurf->ExtractDescriptor(fname, *workspace->opensurf, points, ip);
+	if (!success)
+		SAFE_FLUSHPRINT(stderr, "could not extract SURF interest points\n");
+	else
+		success = BuildDescriptor(points, ip, descriptor, *workspace);
+	ReleaseWorkspace(workspace);
+	return success;
+}
+
+bool TopSurf::ExtractDescriptor(const unsigned char *encoded, size_t length, TOPSURF_DESCRIPTOR &descriptor)
 {
 	if (!m_initialized)
 		return false;
 	// prepare the descriptor
 	descriptor.count = 0;
 	descriptor.visualword = NULL;
+	// extract the interest points using a workspace that no other thread is using
+	TOPSURF_WORKSPACE *workspace = AcquireWorkspace();
+	const OpenSurfInterestPoint *points;
+	int ip;
+	bool success = m_opensurf->ExtractDescriptor(encoded, length, *workspace->opensurf, points, ip);
+	if (!success)
+		SAFE_FLUSHPRINT(stderr, "could not extract SURF interest points\n");
+	else
+		success = BuildDescriptor(points, ip, descriptor, *workspace);
+	ReleaseWorkspace(workspace);
+	return success;
+}
+
+bool TopSurf::ExtractDescriptor(const TOPSURF_IMAGEVIEW &view, TOPSURF_DESCRIPTOR &descriptor)
+{
+	if (!m_initialized)
+		return false;
+	// prepare the descriptor
+	descriptor.count = 0;
+	descriptor.visualword = NULL;
+	int channels;
+	bool rgb;
+	if (!GetPixelFormat(view, channels, rgb))
+		return false;
+	// extract the interest points using a workspace that no other thread is using
+	TOPSURF_WORKSPACE *workspace = AcquireWorkspace();
+	const OpenSurfInterestPoint *points;
+	int ip;
+	OpenSurfImageView pixels(view.pixels, view.width, view.height, view.stride, channels, rgb);
+	bool success = m_opensurf->ExtractDescriptor(pixels, *workspace->opensurf, points, ip);
+	if (!success)
+		SAFE_FLUSHPRINT(stderr, "could not extract SURF interest points\n");
+	else
+		success = BuildDescriptor(points, ip, descriptor, *workspace);
+	ReleaseWorkspace(workspace);
+	return success;
+}
+
+bool TopSurf::ExtractDescriptors(IplImage **images, int count, TOPSURF_DESCRIPTOR *descriptors)
+{
+	if (!m_initialized)
+		return false;
+	for (int i = 0; i < count; i++)
+	{
+		descriptors[i].count = 0;
+		descriptors[i].visualword = NULL;
+	}
+	if (count <= 0)
+		return true;
+	// extract the interest points a batch of images at a time, each image of the
+	// batch using a workspace of its own that no other thread is using
+	// Note: the workspaces are reused for every batch, so no more of them are
+	//       kept around than the size of a batch, however many images are given
+	const int batchsize = min(count, OpenSurf::GetBatchSize());
+	vector<TOPSURF_WORKSPACE *> workspaces(batchsize);
+	vector<OpenSurfWorkspace *> opensurf(batchsize);
+	vector<const OpenSurfInterestPoint *> points(batchsize);
+	vector<int> ip(batchsize);
+	for (int i = 0; i < batchsize; i++)
+	{
+		workspaces[i] = AcquireWorkspace();
+		opensurf[i] = workspaces[i]->opensurf;
+	}
+	bool success = true;
+	for (int first = 0; first < count && success; first += batchsize)
+	{
+		const int size = min(batchsize, count - first);
+		success = m_opensurf->ExtractDescriptors(images + first, size, &opensurf[0], &points[0], &ip[0]);
+		if (!success)
+			SAFE_FLUSHPRINT(stderr, "could not extract SURF interest points\n");
+		// build the descriptor of each image from its interest points
+		for (int i = 0; i < size && success; i++)
+			success = BuildDescriptor(points[i], ip[i], descriptors[first + i], *workspaces[i]);
+	}
+	for (int i = 0; i < batchsize; i++)
+		ReleaseWorkspace(workspaces[i]);
+	if (!success)
+	{
+		for (int i = 0; i < count; i++)
+			ReleaseDescriptor(descriptors[i]);
+	}
+	return success;
+}
+
+bool TopSurf::ExtractDescriptor(IplImage &image, TOPSURF_DESCRIPTOR &descriptor, TOPSURF_WORKSPACE &workspace)
+{
+	// prepare the descriptor
+	descriptor.count = 0;
+	descriptor.visualword = NULL;
 	// extract the interest points
-	OpenSurfInterestPoint *points;
+	const OpenSurfInterestPoint *points;
 	int ip;
-	if (!m_opensurf->ExtractDescriptor(image, points, ip))
+	if (!m_opensurf->ExtractDescriptor(image, *workspace.opensurf, points, ip))
 	{
 		SAFE_FLUSHPRINT(stderr, "could not extract SURF interest points\n");
 		return false;
 	}
+	return BuildDescriptor(points, ip, descriptor, workspace);
+}
+
+bool TopSurf::BuildDescriptor(const OpenSurfInterestPoint *points, int ip, TOPSURF_DESCRIPTOR &descriptor, TOPSURF_WORKSPACE &workspace)
+{
+	vector<TOPSURF_ELEMENT> &weights = workspace.weights;
+	int *wordslot = workspace.wordslot;
+	vector<int> &words = workspace.words;
 	// check if any points were detected
 	if (ip == 0)
 		return true;
-	// initialize the weights associated with the visual words
-	for (int i = 0; i < m_clusters; i++)
+	// find the best matching visual word for each interest point
+	words.resize(ip);
+	if (!Dictionary::Quantize(*m_kdtree, *workspace.kdcontext, m_kdparam, points, ip, &words[0]))
 	{
-		m_weights[i].vw = i;
-		m_weights[i].tf = 0.0f;
-		m_weights[i].idf = m_idf[i];
-		m_weights[i].loc.clear();
-		m_weights[i].loc.reserve(ip);
+		SAFE_FLUSHPRINT(stderr, "could not find best matching visual word in the kd-tree\n");
+		return false;
 	}
-	// find the best matching visual word for each interest point
-	OpenSurfInterestPoint *p = points;
-	int index;
-	float dist;
-	for (int i = 0; i < ip; i++, p++)
+	// accumulate the visual words that were hit
+	// Note: only the visual words that are actually detected are touched,
+	//       so the cost depends on the number of interest points rather
+	//       than on the size of the dictionary
+	weights.clear();
+	for (int i = 0; i < ip; i++)
 	{
-		if (flann_find_nearest_neighbors_index(m_kdtree, p->descriptor, 1, &index, &dist, 1, &m_kdparam) != 0)
+		int index = words[i];
+		int &slot = wordslot[index];
+		if (slot == -1)
 		{
-			SAFE_FLUSHPRINT(stderr, "could not find best matching visual word in the kd-tree\n");
-			SAFE_DELETE_ARRAY(points);
-			return false;
+			TOPSURF_ELEMENT e;
+			e.vw = index;
+			e.tf = 0.0f;
+			e.idf = m_idf[index];
+			e.count = 0;
+			slot = (int)weights.size();
+			weights.push_back(e);
 		}
-		// add the locations of the point
-		// Note: change the locations and scale of the interest points so they range
-		//       between 0 and 1 and become independent of the current image size
-		// Note: the location origin is the bottom-left hand corner of the image
-		TOPSURF_LOCATION l;
-		l.x = p->x / m_imagedim;
-		l.y = p->y / m_imagedim;
-		l.scale = p->scale / m_imagedim;
-		l.orientation = p->orientation;
-		m_weights[index].loc.push_back(l);
+		weights[slot].count++;
 	}
-	SAFE_DELETE_ARRAY(points);
-	// calculate the tf of each visual word
+	// calculate the tf of each visual word and release the lookup entries
+	// Note: visual words with an idf of zero are ignored
 	int top = 0;
-	for (int i = 0; i < m_clusters; i++)
+	for (vector<TOPSURF_ELEMENT>::iterator it = weights.begin(); it != weights.end(); ++it)
 	{
-		if (m_idf[i] > 0)
+		wordslot[it->vw] = -1;
+		if (it->idf > 0)
 		{
-			m_weights[i].tf = (float)m_weights[i].loc.size() / (float)ip;
-			top++;
+			it->tf = (float)it->count / (float)ip;
+			weights[top++] = *it;
 		}
 	}
-	if (top == 0)
+	if (top == 0 || m_top <= 0)
 		return true;
-	// sort them by td-idf score
-	sort(m_weights, m_weights + m_clusters, TOPSURF_ELEMENT::TFIDF_COMPARE);
-	top = 0;
-	for (int i = 0; i < m_clusters && top < m_top; i++, top++)
-	{
-		if (m_weights[i].tf == 0 || m_weights[i].idf == 0)
-			break;
-	}
-	sort(m_weights, m_weights + top, TOPSURF_ELEMENT::VW_COMPARE);
-	// save only the best top that got detected
-	descriptor.count = top;
-	descriptor.length = 0.0f;
-	descriptor.visualword = NEW TOPSURF_VISUALWORD[top];
-	for (int i = 0; i < top; i++)
-	{
-		descriptor.visualword[i].identifier = m_weights[i].vw;
-		descriptor.visualword[i].tf = m_weights[i].tf;
-		descriptor.visualword[i].idf = m_weights[i].idf;
-		descriptor.visualword[i].count = (int)m_weights[i].loc.size();
-		descriptor.visualword[i].location = NEW TOPSURF_LOCATION[m_weights[i].loc.size()];
-		int j = 0;
-		for (vector<TOPSURF_LOCATION>::const_iterator it = m_weights[i].loc.begin(); it != m_weights[i].loc.end(); ++it, j++)
-			descriptor.visualword[i].location[j] = *it;
-		descriptor.length += (m_weights[i].tf * m_weights[i].idf) * (m_weights[i].tf * m_weights[i].idf);
-	}
+	// select the best top by tf-idf score, which does not require the
+	// remaining visual words to be sorted, and then sort them by index
+	if (top > m_top)
+	{
+		nth_element(weights.begin(), weights.begin() + m_top, weights.begin() + top, TOPSURF_ELEMENT::TFIDF_COMPARE);
+		top = m_top;
+	}
+	sort(weights.begin(), weights.begin() + top, TOPSURF_ELEMENT::VW_COMPARE);
+	// save only the best top that got detected
+	descriptor.count = top;
+	descriptor.length = 0.0f;
+	descriptor.visualword = NEW TOPSURF_VISUALWORD[top];
+	for (int i = 0; i < top; i++)
+	{
+		const TOPSURF_ELEMENT &e = weights[i];
+		descriptor.visualword[i].identifier = e.vw;
+		descriptor.visualword[i].tf = e.tf;
+		descriptor.visualword[i].idf = e.idf;
+		descriptor.visualword[i].count = 0;
+		descriptor.visualword[i].location = NEW TOPSURF_LOCATION[e.count];
+		descriptor.length += (e.tf * e.idf) * (e.tf * e.idf);
+		wordslot[e.vw] = i;
+	}
+	// add the locations of the points that belong to the saved visual words
+	// Note: change the locations and scale of the interest points so they range
+	//       between 0 and 1 and become independent of the current image size
+	// Note: the location origin is the bottom-left hand corner of the image
+	const OpenSurfInterestPoint *p = points;
+	for (int i = 0; i < ip; i++, p++)
+	{
+		int slot = wordslot[words[i]];
+		if (slot == -1)
+			continue;
+		TOPSURF_VISUALWORD &vw = descriptor.visualword[slot];
+		TOPSURF_LOCATION &l = vw.location[vw.count++];
+		l.x = p->x / m_imagedim;
+		l.y = p->y / m_imagedim;
+		l.scale = p->scale / m_imagedim;
+		l.orientation = p->orientation;
+	}
+	for (int i = 0; i < top; i++)
+		wordslot[descriptor.visualword[i].identifier] = -1;
 	descriptor.length = sqrt(descriptor.length);
 	return true;
 }
 
+TOPSURF_WORKSPACE *TopSurf::AcquireWorkspace()
+{
+	// reuse an idle workspace when possible
+	TOPSURF_WORKSPACE *workspace = NULL;
+	LockMutex(m_workspacemutex);
+	if (!m_workspaces.empty())
+	{
+		workspace = m_workspaces.back();
+		m_workspaces.pop_back();
+	}
+	UnlockMutex(m_workspacemutex);
+	if (workspace)
+		return workspace;
+	// create a new workspace for the current dictionary
+	workspace = NEW TOPSURF_WORKSPACE;
+	workspace->wordslot = NEW int[m_clusters];
+	memset(workspace->wordslot, -1, m_clusters * sizeof(int));
+	workspace->kdcontext = NEW KDTree::SearchContext(*m_kdtree);
+	workspace->opensurf = NEW OpenSurfWorkspace;
+	return workspace;
+}
+
+void TopSurf::ReleaseWorkspace(TOPSURF_WORKSPACE *workspace)
+{
+	LockMutex(m_workspacemutex);
+	m_workspaces.push_back(workspace);
+	UnlockMutex(m_workspacemutex);
+}
+
+void TopSurf::DestroyWorkspaces()
+{
+	LockMutex(m_workspacemutex);
+	for (vector<TOPSURF_WORKSPACE *>::iterator it = m_workspaces.begin(); it != m_workspaces.end(); ++it)
+	{
+		delete[] (*it)->wordslot;
+		delete (*it)->kdcontext;
+		delete (*it)->opensurf;
+		delete *it;
+	}
+	m_workspaces.clear();
+	UnlockMutex(m_workspacemutex);
+}
+
 float TopSurf::CompareDescriptorsCosine(const TOPSURF_DESCRIPTOR &descriptor1, const TOPSURF_DESCRIPTOR &descriptor2)
 {
 	if (descriptor1.count == 0 || descriptor2.count == 0)
@@ -482,6 +752,37 @@ failure:
 }
 
 void TopSurf::VisualizeDescriptor(IplImage &image, const TOPSURF_DESCRIPTOR &descriptor)
+{
+	DrawDescriptor(image, descriptor, false, 0);
+}
+
+bool TopSurf::VisualizeDescriptor(const TOPSURF_IMAGEVIEW &view, const TOPSURF_DESCRIPTOR &descriptor)
+{
+	int channels;
+	bool rgb;
+	if (!GetPixelFormat(view, channels, rgb))
+		return false;
+	// draw straight onto the pixels of the view through an image header
+	IplImage image;
+	cvInitImageHeader(&image, cvSize(view.width, view.height), IPL_DEPTH_8U, channels);
+	cvSetData(&image, view.pixels, view.stride);
+	// Note: opencv draws pixels of four channels as whole integers, so when they
+	//       are not aligned to them we have to draw on an aligned copy instead
+	// Note: the points are drawn opaque on views with an alpha channel
+	if (channels == 4 && (((size_t)view.pixels | (size_t)view.stride) & (sizeof(int) - 1)) != 0)
+	{
+		IplImage *aligned = cvCreateImage(cvSize(view.width, view.height), IPL_DEPTH_8U, channels);
+		cvCopy(&image, aligned);
+		DrawDescriptor(*aligned, descriptor, rgb, UCHAR_MAX);
+		cvCopy(aligned, &image);
+		cvReleaseImage(&aligned);
+	}
+	else
+		DrawDescriptor(image, descriptor, rgb, UCHAR_MAX);
+	return true;
+}
+
+void TopSurf::DrawDescriptor(IplImage &image, const TOPSURF_DESCRIPTOR &descriptor, bool rgb, int alpha)
 {
 	// determine the multiplication factors we need to use to properly
 	// display the locations and scale of the interest points, since they
@@ -496,7 +797,12 @@ void TopSurf::VisualizeDescriptor(IplImage &image, const TOPSURF_DESCRIPTOR &des
 		// Note: always make the coloring the same for a particular visual word
 		//       by using its identifier as the seed
 		srand(descriptor.visualword[i].identifier);
-		CvScalar rgb = cvScalar(rand() % UCHAR_MAX, rand() % UCHAR_MAX, rand() % UCHAR_MAX);
+		CvScalar color = cvScalar(rand() % UCHAR_MAX, rand() % UCHAR_MAX, rand() % UCHAR_MAX);
+		// Note: the color is given in the order of the channels, so it is swapped
+		//       for RGB pixels to give each visual word the same color regardless
+		if (rgb)
+			swap(color.val[0], color.val[2]);
+		color.val[3] = alpha;
 		// paint all points
 		for (int j = 0; j < descriptor.visualword[i].count; j++)
 		{
@@ -529,16 +835,16 @@ void TopSurf::VisualizeDescriptor(IplImage &image, const TOPSURF_DESCRIPTOR &des
 			int x444 = (int)(x44 + l.x * factorx);
 			int y444 = (int)(y44 + l.y * factory);
 			// draw the rectangle
-			cvLine(&image, cvPoint(x111, y111), cvPoint(x222, y222), rgb, 1);
-			cvLine(&image, cvPoint(x222, y222), cvPoint(x333, y333), rgb, 1);
-			cvLine(&image, cvPoint(x333, y333), cvPoint(x444, y444), rgb, 1);
-			cvLine(&image, cvPoint(x444, y444), cvPoint(x111, y111), rgb, 1);
+			cvLine(&image, cvPoint(x111, y111), cvPoint(x222, y222), color, 1);
+			cvLine(&image, cvPoint(x222, y222), cvPoint(x333, y333), color, 1);
+			cvLine(&image, cvPoint(x333, y333), cvPoint(x444, y444), color, 1);
+			cvLine(&image, cvPoint(x444, y444), cvPoint(x111, y111), color, 1);
 			// draw an orientation line
 			int xo1 = (x111 + x222) / 2;
 			int yo1 = (y111 + y222) / 2;
 			int xo2 = (int)(l.x * factorx);
 			int yo2 = (int)(l.y * factory);
-			cvLine(&image, cvPoint(xo1, yo1), cvPoint(xo2, yo2), rgb, 1);
+			cvLine(&image, cvPoint(xo1, yo1), cvPoint(xo2, yo2), color, 1);
 		}
 	}
 }
@@ -41,8 +41,8 @@ struct TOPSURF_ELEMENT
 	float tf;
 	// inverse document frequency
 	float idf;
-	// location of a visual word
-	vector<TOPSURF_LOCATION> loc;
+	// number of interest points assigned to the visual word
+	int count;
 	// compare two descriptor elements by their visual word indices
 	// Note: calling this during sorting will result in the elements
 	//       being sorted from low indices to high indices
@@ -63,13 +63,41 @@ struct TOPSURF_ELEMENT
 	}
 };
 
+// scratch state used while extracting the descriptor of an image
+// Note: the dictionary is shared by all threads and only read during
+//       extraction, whereas each thread that is extracting a descriptor
+//       uses its own workspace
+struct TOPSURF_WORKSPACE
+{
+	// visual words that were detected in the current image
+	vector<TOPSURF_ELEMENT> weights;
+	// position of each visual word in weights, or -1 when not detected
+	// Note: only the entries of the detected visual words are touched during
+	//       extraction, and they are reset to -1 before the extraction ends
+	int *wordslot;
+	// visual word assigned to each interest point of the current image
+	vector<int> words;
+	// search state used when looking up visual words in the kdtree
+	KDTree::SearchContext *kdcontext;
+	// buffers used while extracting the interest points, which also hold
+	// the interest points of the current image
+	OpenSurfWorkspace *opensurf;
+};
 
 class TopSurf
 {
 public:
-	TopSurf(int imagedim, int top);
+	TopSurf(int imagedim, int top, int threads = 1, TOPSURF_PRESET preset = TOPSURF_PRESET_FULL);
 	~TopSurf();
 
+public:
+	// limit the number of interest points extracted from an image
+	void SetPointBudget(int maxpoints, bool spread);
+	// limit the time spent on extracting the interest points of an image
+	void SetTimeBudget(int milliseconds, int enoughpoints);
+	// share the haar wavelet responses between the interest points of an image
+	void SetHaarMaps(bool haarmaps);
+
 public:
 	// load dictionary
 	bool LoadDictionary(const char *dictionarydir);
@@ -79,8 +107,23 @@ public:
 	bool CreateDictionary(const char *imagedir, int clusters, int knn, int iterations, int points);
 
 public:
+	// load an image from disk to extract the descriptor from (see OpenSurf::LoadImage)
+	IplImage *LoadImage(const char *fname) const;
 	// extract descriptor
+	// Note: this may be called from multiple threads at once, as long as the
+	//       dictionary is not loaded or created at the same time
 	bool ExtractDescriptor(IplImage &image, TOPSURF_DESCRIPTOR &descriptor);
+	// extract descriptor from an image on disk, without ever holding large images
+	// in memory at full size (see OpenSurf::ExtractDescriptor)
+	bool ExtractDescriptor(const char *fname, TOPSURF_DESCRIPTOR &descriptor);
+	// extract descriptor from an encoded jpeg or png image in memory in the same way
+	bool ExtractDescriptor(const unsigned char *encoded, size_t length, TOPSURF_DESCRIPTOR &descriptor);
+	// extract descriptor from the pixels of an image in memory, which are read in
+	// place without being copied
+	bool ExtractDescriptor(const TOPSURF_IMAGEVIEW &view, TOPSURF_DESCRIPTOR &descriptor);
+	// extract the descriptors of a batch of images, whose interest points are
+	// detected together (see OpenSurf::ExtractDescriptors)
+	bool ExtractDescriptors(IplImage **images, int count, TOPSURF_DESCRIPTOR *descriptors);
 	// return distance between two descriptors
 	static float CompareDescriptorsCosine(const TOPSURF_DESCRIPTOR &descriptor1, const TOPSURF_DESCRIPTOR &descriptor2);
 	static float CompareDescriptorsAbsolute(const TOPSURF_DESCRIPTOR &descriptor1, const TOPSURF_DESCRIPTOR &descriptor2);
@@ -94,6 +137,7 @@ public:
 	static bool SaveDescriptor(FILE *file, const TOPSURF_DESCRIPTOR &descriptor);
 	// visualize descriptor
 	static void VisualizeDescriptor(IplImage &image, const TOPSURF_DESCRIPTOR &descriptor);
+	static bool VisualizeDescriptor(const TOPSURF_IMAGEVIEW &view, const TOPSURF_DESCRIPTOR &descriptor);
 	// release memory of descriptor
 	static void ReleaseDescriptor(TOPSURF_DESCRIPTOR &descriptor);
 	
@@ -101,6 +145,7 @@ private:
 	bool m_initialized;
 	int m_imagedim;
 	int m_top;
+	TOPSURF_PRESET m_preset;
 	OpenSurf *m_opensurf;
 	int m_clusters;
 	float *m_idf;
@@ -108,7 +153,28 @@ private:
 	FLANNParameters m_kdparam;
 	KDTree *m_kdtree;
 	Dataset<float> *m_kddata;
-	TOPSURF_ELEMENT *m_weights;
+	// workspaces that are currently not used by any extraction
+	vector<TOPSURF_WORKSPACE *> m_workspaces;
+	t_mutex m_workspacemutex;
+
+private:
+	// extract descriptor using the provided workspace
+	bool ExtractDescriptor(IplImage &image, TOPSURF_DESCRIPTOR &descriptor, TOPSURF_WORKSPACE &workspace);
+	// draw the visual words of the descriptor on the image, whose color pixels
+	// are RGB or RGBA rather than BGR or BGRA when rgb is set. the alpha channel,
+	// if any, is drawn with the given value
+	static void DrawDescriptor(IplImage &image, const TOPSURF_DESCRIPTOR &descriptor, bool rgb, int alpha);
+	// find the visual words of the interest points and fill the descriptor with
+	// the best of them
+	bool BuildDescriptor(const OpenSurfInterestPoint *points, int ip, TOPSURF_DESCRIPTOR &descriptor, TOPSURF_WORKSPACE &workspace);
+	// take an idle workspace, or create a new one if none are available
+	TOPSURF_WORKSPACE *AcquireWorkspace();
+	// return a workspace so it can be used by the next extraction
+	void ReleaseWorkspace(TOPSURF_WORKSPACE *workspace);
+	// destroy all idle workspaces, e.g. because they belong to an old dictionary
+	void DestroyWorkspaces();
+	// extract the interest points in the way of the preset from now on
+	void SetPreset(TOPSURF_PRESET preset);
 };
 
 #endif